@@ -18,6 +18,13 @@
 #include "common.h"
 #include "bit_utils.h"
 #include "bitvector.h"
+#include "lookup_service.h"
+#include "vector_bank.h"
+#include "bitmap_index.h"
+#include "bit_matrix.h"
+#include "packed_array.h"
+#include "ring_bitmap.h"
+#include "bitap.h"
 #ifndef ERR
 #define ERR
 #endif
@@ -259,6 +266,383 @@ bv_and_performance(struct bit_vector** bvs0, testset* testsets, int test_num)
     return ;
 }
 
+/**
+ * Interleaves a large bv_and_with_dst() with random reads from a
+ * cache-resident table, once through the cache and once with streaming
+ * stores, to show how much the output evicts the concurrent workload.
+ */
+void
+bv_stream_performance(size_t bytes)
+{
+    size_t hot_num = (16 << 20) / sizeof(uint32_t);
+    elem_t bit_size = (elem_t) bytes << 3;
+    struct bit_vector* bv0 = bv_create(bit_size);
+    struct bit_vector* bv1 = bv_create(bit_size);
+    struct bit_vector* dst = bv_create(bit_size);
+    uint32_t* hot = (uint32_t*) malloc(sizeof(uint32_t) * hot_num);
+    if (!bv0 || !bv1 || !dst || !hot) {
+        LOG(ERR, "Failed to allocate stream test vectors\n");
+        goto out;
+    }
+    memset(bv0->arr, 0xaa, bv0->allocated);
+    memset(bv1->arr, 0x5f, bv1->allocated);
+    for (size_t i = 0; i < hot_num; ++i) hot[i] = rand();
+
+    printf("output: %lu MB, stream threshold: %lu MB\n",
+           bytes >> 20, bv_stream_threshold() >> 20);
+    uint64_t dummy = 0;
+    uint32_t x = 2463534242U;
+    int rounds = 8, lookups = 1 << 22;
+    size_t saved = bv_stream_threshold();
+    for (int mode = 0; mode < 2; ++mode) {
+        bv_set_stream_threshold(mode ? 1 : SIZE_MAX);
+        double op_time = 0, hot_time = 0;
+        for (int r = 0; r < rounds; ++r) {
+            double t0 = NOW();
+            bv_and_with_dst(dst, bv0, bv1);
+            double t1 = NOW();
+            for (int k = 0; k < lookups; ++k) {
+                x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+                dummy += hot[x & (hot_num - 1)];
+            }
+            double t2 = NOW();
+            op_time += t1 - t0;
+            hot_time += t2 - t1;
+        }
+        printf("%s and: %lf GB/s, hot table lookups: ",
+               mode ? "streaming" : "cached   ",
+               (double) dst->allocated * rounds / op_time * 1e-9);
+        DISPLAY(lookups * rounds, 0, hot_time);
+    }
+    bv_set_stream_threshold(saved);
+    printf("dummy_print: %lu\n", dummy);
+
+out:
+    free(hot);
+    if (bv0) bv_destroy(bv0);
+    if (bv1) bv_destroy(bv1);
+    if (dst) bv_destroy(dst);
+}
+
+/**
+ * Runs the bv_and_performance() query mix through the lookup service with
+ * 1, 2, 4, ... workers up to the number of online CPUs.
+ */
+void
+bv_lookup_service_performance(struct bit_vector** bvs0, int test_num)
+{
+    int query_num = test_num * 64;
+    struct lookup_query* queries =
+        (struct lookup_query*) malloc(sizeof(struct lookup_query) * query_num);
+    struct lookup_result* results =
+        (struct lookup_result*) malloc(sizeof(struct lookup_result) * 1024);
+    if (!queries || !results) {
+        LOG(ERR, "Failed to allocate queries\n");
+        goto out;
+    }
+    for (int q = 0; q < query_num; ++q) {
+        int i = q % test_num, j = q / test_num;
+        queries[q].num = 8;
+        for (int k = 0; k < 8; ++k)
+            queries[q].ids[k] = (i + (j + 1) * k) & (test_num - 1);
+        queries[q].cookie = NULL;
+    }
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int workers = 1; workers <= ncpu; workers <<= 1) {
+        struct lookup_service* ls = ls_create(bvs0, test_num, workers, NULL);
+        if (ls == NULL) {
+            LOG(ERR, "Failed to start lookup service\n");
+            goto out;
+        }
+        int64_t dummy = 0;
+        int submitted = 0, received = 0;
+        double start = NOW();
+        while (received < query_num) {
+            if (submitted < query_num)
+                submitted += ls_submit(ls, queries + submitted,
+                                       query_num - submitted);
+            int got = ls_poll(ls, results, 1024);
+            for (int k = 0; k < got; ++k) dummy += results[k].match;
+            received += got;
+        }
+        double end = NOW();
+        ls_destroy(ls);
+        printf("%d workers (dummy %ld): ", workers, dummy);
+        DISPLAY(query_num, start, end);
+    }
+
+out:
+    free(queries);
+    free(results);
+}
+
+/**
+ * 8-field lookups with every field's vectors in a separate allocation
+ * versus the same vectors interleaved into one bank per rule group.
+ */
+void
+bv_bank_performance(struct bit_vector** bvs0, int test_num)
+{
+    int fields = 8, groups = test_num / fields;
+    struct vector_bank** banks =
+        (struct vector_bank**) calloc(groups, sizeof(struct vector_bank*));
+    struct bit_vector* dst = bv_create(bvs0[0]->size);
+    if (!banks || !dst) {
+        LOG(ERR, "Failed to allocate banks\n");
+        goto out;
+    }
+    for (int g = 0; g < groups; ++g) {
+        banks[g] = vb_from_bvs(bvs0 + g * fields, fields);
+        if (banks[g] == NULL) {
+            LOG(ERR, "Failed to allocate banks\n");
+            goto out;
+        }
+    }
+
+    int count = 2000;
+    uint64_t dummy = 0;
+    double start = NOW();
+    for (int j = 0; j < count; ++j) {
+        for (int g = 0; g < groups; ++g) {
+            bv_multiple_and_256(dst, bvs0 + ((g * 7 + j) % groups) * fields,
+                                fields);
+            dummy += dst->arr[0];
+        }
+    }
+    double end = NOW();
+    printf("separate: ");
+    DISPLAY(groups * count, start, end);
+
+    start = NOW();
+    for (int j = 0; j < count; ++j) {
+        for (int g = 0; g < groups; ++g) {
+            vb_multiple_and(dst, banks[(g * 7 + j) % groups], NULL, fields);
+            dummy += dst->arr[0];
+        }
+    }
+    end = NOW();
+    printf("bank:     ");
+    DISPLAY(groups * count, start, end);
+    printf("dummy_print: %lu\n", dummy);
+
+out:
+    if (banks) {
+        for (int g = 0; g < groups; ++g) {
+            if (banks[g]) vb_destroy(banks[g]);
+        }
+        free(banks);
+    }
+    if (dst) bv_destroy(dst);
+}
+
+/**
+ * Range query latency of every index encoding against a plain scan of
+ * the column that sets the matching rows.
+ */
+void
+bv_bitmap_index_performance(elem_t rows, uint32_t card)
+{
+    static const char* names[] = {
+        "equality ", "range    ", "interval ", "bitsliced",
+    };
+    int query_num = 200;
+    uint32_t* column = (uint32_t*) malloc(sizeof(uint32_t) * rows);
+    uint32_t* bounds = (uint32_t*) malloc(sizeof(uint32_t) * query_num * 2);
+    struct bit_vector* dst = bv_create(rows);
+    if (!column || !bounds || !dst) {
+        LOG(ERR, "Failed to allocate column\n");
+        goto out;
+    }
+    for (elem_t r = 0; r < rows; ++r) column[r] = rand() % card;
+    column[0] = card - 1;
+    for (int q = 0; q < query_num; ++q) {
+        uint32_t a = rand() % card, b = rand() % card;
+        bounds[q * 2] = min(a, b);
+        bounds[q * 2 + 1] = max(a, b) + 1;
+    }
+
+    uint64_t dummy = 0;
+    double start = NOW();
+    for (int q = 0; q < query_num; ++q) {
+        uint32_t lo = bounds[q * 2], hi = bounds[q * 2 + 1];
+        memset(dst->arr, 0, dst->allocated);
+        for (elem_t r = 0; r < rows; ++r) {
+            uint8_t hit = column[r] - lo < hi - lo;
+            dst->arr[r >> 3] |= hit << (r & 7);
+        }
+        dummy += dst->arr[q];
+    }
+    double end = NOW();
+    printf("column scan: %lf us/query\n", (end - start) * 1e6 / query_num);
+
+    for (int enc = BI_EQUALITY; enc <= BI_BITSLICED; ++enc) {
+        struct bitmap_index* bi = bi_build(column, rows, enc);
+        if (bi == NULL) {
+            LOG(ERR, "Failed to build index\n");
+            continue;
+        }
+        start = NOW();
+        for (int q = 0; q < query_num; ++q) {
+            bi_range(bi, bounds[q * 2], bounds[q * 2 + 1], dst);
+            dummy += dst->arr[q];
+        }
+        end = NOW();
+        printf("%s (%d vectors): %lf us/query\n", names[enc], bi->num,
+               (end - start) * 1e6 / query_num);
+        bi_destroy(bi);
+    }
+    printf("dummy_print: %lu\n", dummy);
+
+out:
+    free(column);
+    free(bounds);
+    if (dst) bv_destroy(dst);
+}
+
+// n x n GF(2) product on all CPUs
+void
+bv_matrix_performance(elem_t n)
+{
+    struct bit_matrix* a = bm_create(n, n);
+    struct bit_matrix* b = bm_create(n, n);
+    struct bit_matrix* c = bm_create(n, n);
+    if (!a || !b || !c) {
+        LOG(ERR, "Failed to allocate matrices\n");
+        goto out;
+    }
+    for (elem_t i = 0; i < n; ++i) {
+        for (elem_t j = 0; j < n; j += 7) {
+            bm_set(a, i, j, rand() & 1);
+            bm_set(b, i, j, rand() & 1);
+        }
+    }
+    double start = NOW();
+    if (!bm_mul(c, a, b, 0)) LOG(ERR, "Failed to multiply\n");
+    double end = NOW();
+    printf("%lux%lu product: %lf ms\n", n, n, (end - start) * 1e3);
+
+out:
+    if (a) bm_destroy(a);
+    if (b) bm_destroy(b);
+    if (c) bm_destroy(c);
+}
+
+void
+bv_packed_performance(elem_t n)
+{
+    uint32_t* vals = (uint32_t*) malloc(n * sizeof(uint32_t));
+    struct bit_vector* res = bv_create(n);
+    if (!vals || !res) {
+        LOG(ERR, "Failed to allocate buffers\n");
+        goto out;
+    }
+    int widths[] = {5, 9, 13};
+    for (int w = 0; w < 3; ++w) {
+        int k = widths[w];
+        struct packed_array* pa = pa_create(n, k);
+        if (pa == NULL) {
+            LOG(ERR, "Failed to create packed array\n");
+            goto out;
+        }
+        for (elem_t i = 0; i < n; ++i) vals[i] = rand() & KBITS_MASK_32(k);
+        double t0 = NOW();
+        pa_pack(pa, 0, vals, n);
+        double t1 = NOW();
+        pa_unpack(pa, 0, n, vals);
+        double t2 = NOW();
+        pa_compare(res, pa, PA_LT, 1U << (k - 1));
+        double t3 = NOW();
+        // throughput in terms of the unpacked uint32_t data
+        double gb = n * sizeof(uint32_t) / 1e9;
+        printf("k=%2d packed %lu bytes (%.1fx): pack %.2lf GB/s, "
+               "unpack %.2lf GB/s, compare %.2lf GB/s\n",
+               k, pa->bv->allocated, 32.0 / k,
+               gb / (t1 - t0), gb / (t2 - t1), gb / (t3 - t2));
+        pa_destroy(pa);
+    }
+
+out:
+    if (vals) free(vals);
+    if (res) bv_destroy(res);
+}
+
+void
+bv_ring_performance(elem_t size, int num)
+{
+    const elem_t batch = 1 << 20;
+    elem_t* ids = (elem_t*) malloc(batch * sizeof(elem_t));
+    bool* out = (bool*) malloc(batch * sizeof(bool));
+    struct ring_bitmap* rb = rb_create(size, num);
+    if (!ids || !out || !rb) {
+        LOG(ERR, "Failed to allocate the ring\n");
+        goto out;
+    }
+    for (elem_t j = 0; j < batch; ++j)
+        ids[j] = (((elem_t) rand() << 31) ^ rand()) % size;
+
+    // one batch per bucket, twice around the ring so buckets get reused
+    double insert = 0, query = 0, rotate = 0;
+    for (int r = 0; r < 2 * num; ++r) {
+        double t0 = NOW();
+        rb_insert_batch(rb, ids, batch);
+        double t1 = NOW();
+        rb_query_batch(rb, ids, batch, out);
+        double t2 = NOW();
+        rb_rotate(rb);
+        double t3 = NOW();
+        insert += t1 - t0;
+        query += t2 - t1;
+        rotate = max(rotate, t3 - t2);
+        ids[r % batch] ^= 1;
+    }
+    elem_t total = 2 * num * batch;
+    printf("%d x %lu bits: insert %.1lf M/s, query %.1lf M/s, "
+           "rotate <= %.3lf us\n", num, size, total / insert / 1e6,
+           total / query / 1e6, rotate * 1e6);
+
+out:
+    if (ids) free(ids);
+    if (out) free(out);
+    if (rb) rb_destroy(rb);
+}
+
+void
+bv_bitap_performance(elem_t len, int num, elem_t plen)
+{
+    uint8_t* text = (uint8_t*) malloc(len);
+    uint8_t* pat = (uint8_t*) malloc(num * plen);
+    const uint8_t* pats[num];
+    elem_t lens[num];
+    struct ba_match out[16];
+    struct bitap* ba = NULL;
+    if (!text || !pat) {
+        LOG(ERR, "Failed to allocate buffers\n");
+        goto out;
+    }
+    for (elem_t i = 0; i < len; ++i) text[i] = rand();
+    for (elem_t i = 0; i < num * plen; ++i) pat[i] = rand();
+    for (int p = 0; p < num; ++p) {
+        pats[p] = pat + p * plen;
+        lens[p] = plen;
+    }
+    ba = ba_create(pats, lens, num);
+    if (ba == NULL) {
+        LOG(ERR, "Failed to compile patterns\n");
+        goto out;
+    }
+    double start = NOW();
+    elem_t found = ba_scan(ba, text, len, out, 16);
+    double end = NOW();
+    printf("%d x %lu-byte patterns: %.2lf GB/s, %lu matches\n",
+           num, plen, len / (end - start) / 1e9, found);
+
+out:
+    if (ba) ba_destroy(ba);
+    if (pat) free(pat);
+    if (text) free(text);
+}
+
 bool
 gen_bitvectors(struct bit_vector*** bvs, int bv_size, int bv_num)
 {
@@ -289,7 +673,7 @@ void
 print_usage()
 {
     printf("Usage: ./benchmark"
-           " <bitvector size> <num>\n");
+           " <bitvector size> <num> [stream output MB]\n");
 }
 
 int 
@@ -331,10 +715,48 @@ main(int argc, char **argv)
     }
     LOG(INFO, "[SUCCESS] generate testset\n\n");
         
+    LOG(INFO, "calibrate prefetch distance\n");
+    printf("prefetch distance: %lu bytes\n", bv_calibrate_prefetch(bv_size, 8));
+
     LOG(INFO, "start performance test\n");
     bv_and_performance(bvs, testsets, bv_num);
     LOG(INFO, "[SUCCESS] performance test\n\n");
 
+    LOG(INFO, "start bank layout test\n");
+    bv_bank_performance(bvs, bv_num);
+    LOG(INFO, "[SUCCESS] bank layout test\n\n");
+
+    LOG(INFO, "start bitmap index test\n");
+    bv_bitmap_index_performance(1 << 22, 256);
+    LOG(INFO, "[SUCCESS] bitmap index test\n\n");
+
+    LOG(INFO, "start gf(2) matrix test\n");
+    bv_matrix_performance(8192);
+    LOG(INFO, "[SUCCESS] gf(2) matrix test\n\n");
+
+    LOG(INFO, "start packed array test\n");
+    bv_packed_performance(1 << 24);
+    LOG(INFO, "[SUCCESS] packed array test\n\n");
+
+    LOG(INFO, "start sliding window test\n");
+    bv_ring_performance(1 << 27, 8);
+    LOG(INFO, "[SUCCESS] sliding window test\n\n");
+
+    LOG(INFO, "start shift-and test\n");
+    bv_bitap_performance(256 << 20, 1, 1000);
+    bv_bitap_performance(256 << 20, 4, 1000);
+    LOG(INFO, "[SUCCESS] shift-and test\n\n");
+
+    LOG(INFO, "start lookup service test\n");
+    bv_lookup_service_performance(bvs, bv_num);
+    LOG(INFO, "[SUCCESS] lookup service test\n\n");
+
+    LOG(INFO, "start streaming store test\n");
+    size_t stream_bytes = argc > 3 ? (size_t) atoi(argv[3]) << 20
+                                   : bv_stream_threshold() * 2;
+    bv_stream_performance(stream_bytes);
+    LOG(INFO, "[SUCCESS] streaming store test\n\n");
+
     /*
     if (bvss) {
         for (int i = 0; i < bv_num; ++i) {
@@ -0,0 +1,284 @@
+/**
+ *  bit_matrix.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "bit_matrix.h"
+
+// bounds of the column tile width in bytes
+#define MIN_TILE 64
+#define MAX_TILE 1024
+
+struct bit_matrix*
+bm_create(elem_t rows, elem_t cols)
+{
+    elem_t stride = ROUNDUP64(ROUNDUP8(cols) >> 3);
+    size_t msize = sizeof(struct bit_matrix) + rows * stride;
+    void* p;
+    if (posix_memalign(&p, 64, msize)) return NULL;
+    struct bit_matrix* m = (struct bit_matrix*) p;
+    m->rows = rows;
+    m->cols = cols;
+    m->stride = stride;
+    memset(m->arr, 0, rows * stride);
+    return m;
+}
+
+void
+bm_destroy(struct bit_matrix* m)
+{
+    free(m);
+}
+
+void
+bm_set(struct bit_matrix* m, elem_t i, elem_t j, bool val)
+{
+    assert(i < m->rows && j < m->cols);
+    uint8_t* p = bm_row(m, i) + (j >> 3);
+    *p = (*p & ~(1 << (j & 7))) | (val << (j & 7));
+}
+
+bool
+bm_get(struct bit_matrix* m, elem_t i, elem_t j)
+{
+    assert(i < m->rows && j < m->cols);
+    return (bm_row(m, i)[j >> 3] >> (j & 7)) & 1;
+}
+
+struct bit_matrix*
+bm_from_bvs(struct bit_vector** rows, elem_t n)
+{
+    assert(n > 0);
+    struct bit_matrix* m = bm_create(n, rows[0]->size);
+    if (m == NULL) return NULL;
+    for (elem_t i = 0; i < n; ++i) {
+        if (!bm_store_row(m, i, rows[i])) {
+            bm_destroy(m);
+            return NULL;
+        }
+    }
+    return m;
+}
+
+bool
+bm_load_row(struct bit_matrix* m, elem_t i, struct bit_vector* bv)
+{
+    if (i >= m->rows || bv->size != m->cols) return false;
+    memcpy(bv->arr, bm_row(m, i), m->stride);
+    memset(bv->arr + m->stride, 0, bv->allocated - m->stride);
+    return true;
+}
+
+bool
+bm_store_row(struct bit_matrix* m, elem_t i, struct bit_vector* bv)
+{
+    if (i >= m->rows || bv->size != m->cols) return false;
+    memcpy(bm_row(m, i), bv->arr, m->stride);
+    return true;
+}
+
+void
+bm_mul_vec(struct bit_vector* dst, struct bit_matrix* m, struct bit_vector* x)
+{
+    assert(x->size >= m->cols && dst->size >= m->rows);
+    memset(dst->arr, 0, dst->allocated);
+    for (elem_t i = 0; i < m->rows; ++i) {
+        const uint8_t* row = bm_row(m, i);
+        __m256i acc = _mm256_setzero_si256();
+        for (elem_t k = 0; k < m->stride; k += 32) {
+            __m256i r = _mm256_load_si256((__m256i*) (row+k));
+            __m256i v = _mm256_load_si256((__m256i*) (x->arr+k));
+            acc = _mm256_xor_si256(acc, _mm256_and_si256(r, v));
+        }
+        // parity of the dot product
+        __m128i h = _mm_xor_si128(_mm256_castsi256_si128(acc),
+                                  _mm256_extracti128_si256(acc, 1));
+        uint64_t w = (uint64_t) _mm_cvtsi128_si64(h) ^
+                     (uint64_t) _mm_extract_epi64(h, 1);
+        dst->arr[i >> 3] |= __builtin_parityll(w) << (i & 7);
+    }
+}
+
+void
+bm_vec_mul(struct bit_vector* dst, struct bit_vector* x, struct bit_matrix* m)
+{
+    assert(x->size >= m->rows && dst->size >= m->cols);
+    memset(dst->arr, 0, dst->allocated);
+    for (int64_t i = bv_ffs(x); i >= 0 && (elem_t) i < m->rows;
+         i = bv_find_next(x, i + 1)) {
+        const uint8_t* row = bm_row(m, i);
+        for (elem_t k = 0; k < m->stride; k += 32) {
+            __m256i r = _mm256_load_si256((__m256i*) (row+k));
+            __m256i v = _mm256_load_si256((__m256i*) (dst->arr+k));
+            _mm256_store_si256((__m256i*) (dst->arr+k), _mm256_xor_si256(r, v));
+        }
+    }
+}
+
+/**
+ * Table t[idx] = XOR of the rows 8 blk + b of B for every bit b of idx,
+ * restricted to the tile's bytes.  Each entry is one row XOR away from
+ * the entry without its lowest bit.
+ */
+static void
+build_table(uint8_t* t, elem_t tile, struct bit_matrix* b, elem_t blk,
+            elem_t off, elem_t w)
+{
+    elem_t first = blk << 3;
+    int valid = b->rows - first < 8 ? (int) (b->rows - first) : 8;
+    memset(t, 0, w);
+    for (int idx = 1; idx < (1 << valid); ++idx) {
+        const uint8_t* prev = t + (idx & (idx - 1)) * tile;
+        const uint8_t* row = bm_row(b, first + __builtin_ctz(idx)) + off;
+        uint8_t* cur = t + idx * tile;
+        for (elem_t k = 0; k < w; k += 32) {
+            __m256i v = _mm256_xor_si256(_mm256_load_si256((__m256i*) (prev+k)),
+                                         _mm256_load_si256((__m256i*) (row+k)));
+            _mm256_store_si256((__m256i*) (cur+k), v);
+        }
+    }
+}
+
+// c ^= t[0] ^ ... ^ t[tn - 1] over w bytes
+static inline void
+xor_rows(uint8_t* c, const uint8_t** t, int tn, elem_t w)
+{
+#ifdef __AVX512F__
+    for (elem_t k = 0; k < w; k += 64) {
+        __m512i v = _mm512_load_si512((__m512i*) (c+k));
+        for (int j = 0; j < tn; ++j)
+            v = _mm512_xor_si512(v, _mm512_load_si512((__m512i*) (t[j]+k)));
+        _mm512_store_si512((__m512i*) (c+k), v);
+    }
+#else
+    if (likely(tn == BM_TABLES)) {
+        for (elem_t k = 0; k < w; k += 32) {
+            __m256i v = _mm256_load_si256((__m256i*) (c+k));
+            __m256i x0 = _mm256_load_si256((__m256i*) (t[0]+k));
+            __m256i x1 = _mm256_load_si256((__m256i*) (t[1]+k));
+            for (int j = 2; j < BM_TABLES; j += 2) {
+                x0 = _mm256_xor_si256(x0, _mm256_load_si256((__m256i*) (t[j]+k)));
+                x1 = _mm256_xor_si256(x1, _mm256_load_si256((__m256i*) (t[j+1]+k)));
+            }
+            v = _mm256_xor_si256(v, _mm256_xor_si256(x0, x1));
+            _mm256_store_si256((__m256i*) (c+k), v);
+        }
+        return;
+    }
+    for (elem_t k = 0; k < w; k += 32) {
+        __m256i v = _mm256_load_si256((__m256i*) (c+k));
+        for (int j = 0; j < tn; ++j)
+            v = _mm256_xor_si256(v, _mm256_load_si256((__m256i*) (t[j]+k)));
+        _mm256_store_si256((__m256i*) (c+k), v);
+    }
+#endif
+}
+
+struct mul_job {
+    struct bit_matrix* a;
+    struct bit_matrix* b;
+    struct bit_matrix* c;
+    // column tile width, so that the tables fill half of L2
+    elem_t tile;
+    elem_t tiles;
+    elem_t blocks;
+    // next (row block, column tile) unit to hand out
+    volatile elem_t next;
+};
+
+static void
+mul_unit(struct mul_job* job, uint8_t* tables, elem_t rb, elem_t ct)
+{
+    struct bit_matrix *a = job->a, *b = job->b, *c = job->c;
+    elem_t tile = job->tile, table_size = tile << 8;
+    elem_t off = ct * tile;
+    elem_t w = min(c->stride - off, tile);
+    elem_t r0 = rb * BM_ROW_BLOCK;
+    elem_t r1 = min(r0 + BM_ROW_BLOCK, c->rows);
+    elem_t kblocks = ROUNDUP8(a->cols) >> 3;
+
+    for (elem_t i = r0; i < r1; ++i)
+        memset(bm_row(c, i) + off, 0, w);
+    for (elem_t kb = 0; kb < kblocks; kb += BM_TABLES) {
+        int tn = min(kblocks - kb, (elem_t) BM_TABLES);
+        for (int j = 0; j < tn; ++j)
+            build_table(tables + j * table_size, tile, b, kb + j, off, w);
+        for (elem_t i = r0; i < r1; ++i) {
+            const uint8_t* sel = bm_row(a, i) + kb;
+            const uint8_t* t[BM_TABLES];
+            for (int j = 0; j < tn; ++j)
+                t[j] = tables + j * table_size + sel[j] * tile;
+            xor_rows(bm_row(c, i) + off, t, tn, w);
+        }
+    }
+}
+
+static void*
+mul_worker(void* arg)
+{
+    struct mul_job* job = (struct mul_job*) arg;
+    void* tables;
+    if (posix_memalign(&tables, 64, BM_TABLES * (job->tile << 8)))
+        return NULL;
+    elem_t total = job->tiles * job->blocks;
+    for (;;) {
+        elem_t k = __sync_fetch_and_add(&job->next, 1);
+        if (k >= total) break;
+        mul_unit(job, (uint8_t*) tables, k / job->tiles, k % job->tiles);
+    }
+    free(tables);
+    return NULL;
+}
+
+bool
+bm_mul(struct bit_matrix* c, struct bit_matrix* a, struct bit_matrix* b,
+       int threads)
+{
+    assert(a->cols == b->rows && c->rows == a->rows && c->cols == b->cols);
+    assert(c != a && c != b);
+
+    struct mul_job job;
+    memset(&job, 0, sizeof(job));
+    job.a = a;
+    job.b = b;
+    job.c = c;
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 <= 0) l2 = 256 << 10;
+    job.tile = MIN_TILE;
+    while (job.tile < MAX_TILE && (job.tile << 9) * BM_TABLES <= (elem_t) l2 / 2)
+        job.tile <<= 1;
+    job.tiles = (c->stride + job.tile - 1) / job.tile;
+    job.blocks = (c->rows + BM_ROW_BLOCK - 1) / BM_ROW_BLOCK;
+
+    if (threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0) threads = 1;
+    elem_t units = job.tiles * job.blocks;
+    if ((elem_t) threads > units) threads = max((int) units, 1);
+    pthread_t tids[threads];
+    int started = 0;
+    for (; started < threads - 1; ++started) {
+        if (pthread_create(&tids[started], NULL, mul_worker, &job))
+            break;
+    }
+    // the calling thread takes part too, so a failed create only slows down
+    mul_worker(&job);
+    for (int i = 0; i < started; ++i)
+        pthread_join(tids[i], NULL);
+    // a worker that could not allocate its tables takes no units, so all
+    // were done unless every worker failed
+    return job.next >= units;
+}
@@ -0,0 +1,91 @@
+/**
+ *  bit_matrix.h
+ *
+ *  Dense matrices over GF(2), stored row-major with every row laid out
+ *  like bit_vector.arr.  Products use the Method of Four Russians: eight
+ *  rows of B at a time are expanded into a table of all 256 of their
+ *  XOR combinations, so that a byte of A selects a whole precomputed row
+ *  sum.  The columns are cut into tiles whose tables stay in L2.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef BIT_MATRIX_H
+#define BIT_MATRIX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// rows of A (and C) sharing one set of tables
+#ifndef BM_ROW_BLOCK
+#define BM_ROW_BLOCK 2048
+#endif
+
+// 8-bit tables applied per pass over a row block
+#define BM_TABLES 4
+
+struct bit_matrix {
+    elem_t rows;
+    elem_t cols;
+    // bytes per row, a multiple of 64; bits past cols are zero
+    elem_t stride;
+    uint8_t arr[0] __attribute__((aligned(64)));
+};
+
+static inline uint8_t*
+bm_row(struct bit_matrix* m, elem_t i)
+{
+    return m->arr + i * m->stride;
+}
+
+// rows x cols zero matrix
+struct bit_matrix*
+bm_create(elem_t rows, elem_t cols);
+
+void
+bm_destroy(struct bit_matrix* m);
+
+void
+bm_set(struct bit_matrix* m, elem_t i, elem_t j, bool val);
+
+bool
+bm_get(struct bit_matrix* m, elem_t i, elem_t j);
+
+// matrix whose row i is a copy of rows[i]; all rows must have one size
+struct bit_matrix*
+bm_from_bvs(struct bit_vector** rows, elem_t n);
+
+// copies row i to or from bv, which must be cols bits long
+bool
+bm_load_row(struct bit_matrix* m, elem_t i, struct bit_vector* bv);
+
+bool
+bm_store_row(struct bit_matrix* m, elem_t i, struct bit_vector* bv);
+
+// dst = m x, dst has m->rows bits and x m->cols bits
+void
+bm_mul_vec(struct bit_vector* dst, struct bit_matrix* m, struct bit_vector* x);
+
+// dst = x^T m, the XOR of the rows selected by x
+void
+bm_vec_mul(struct bit_vector* dst, struct bit_vector* x, struct bit_matrix* m);
+
+/**
+ * c = a b.  c must be a->rows x b->cols and distinct from a and b.
+ * Column tiles and row blocks are spread over threads workers (0 picks
+ * the number of online CPUs).  Returns false if the tables could not be
+ * allocated.
+ */
+bool
+bm_mul(struct bit_matrix* c, struct bit_matrix* a, struct bit_matrix* b,
+       int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,216 @@
+/**
+ *  bit_view.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "simd_utils.h"
+#include "bit_view.h"
+
+enum view_op {
+    VW_COPY,
+    VW_NOT,
+    VW_AND,
+    VW_OR,
+    VW_XOR,
+};
+
+// source bytes the view touches
+static inline elem_t
+span(const struct bit_view* v)
+{
+    return (v->offset + v->size + 7) >> 3;
+}
+
+/**
+ * Whether load_256() at bit stays inside the view.  A byte-aligned load
+ * reads exactly its 32 bytes, which bit + 256 <= size already keeps in
+ * the view; a shifted one reads 8 bytes past them.
+ */
+static inline bool
+chunk_fits(const struct bit_view* v, elem_t bit)
+{
+    elem_t s = bit + v->offset;
+    if (bit + 256 > v->size) return false;
+    return !(s & 7) || (s >> 3) + 40 <= span(v);
+}
+
+// view bits [bit, bit + 256)
+static inline __m256i
+load_256(const struct bit_view* v, elem_t bit)
+{
+    elem_t s = bit + v->offset;
+    const uint8_t* p = v->arr + (s >> 3);
+    __m256i lo = _mm256_loadu_si256((const __m256i*) p);
+    int sh = s & 7;
+    if (!sh) return lo;
+    // lane i is word i shifted down, topped up from word i + 1
+    __m256i hi = _mm256_loadu_si256((const __m256i*) (p + 8));
+    return _mm256_or_si256(_mm256_srl_epi64(lo, _mm_cvtsi32_si128(sh)),
+                           _mm256_sll_epi64(hi, _mm_cvtsi32_si128(64 - sh)));
+}
+
+// view bits [bit, bit + 64), zero past the end
+static inline uint64_t
+load_64(const struct bit_view* v, elem_t bit)
+{
+    if (bit >= v->size) return 0;
+    elem_t s = bit + v->offset;
+    elem_t byte = s >> 3, avail = span(v) - byte;
+    uint8_t buf[16] = {0};
+    memcpy(buf, v->arr + byte, avail < 9 ? avail : 9);
+    uint64_t w;
+    memcpy(&w, buf, 8);
+    int sh = s & 7;
+    if (sh) w = (w >> sh) | ((uint64_t) buf[8] << (64 - sh));
+    elem_t left = v->size - bit;
+    if (left < 64) w &= (1ULL << left) - 1;
+    return w;
+}
+
+static inline __m256i
+op_256(enum view_op op, __m256i a, __m256i b)
+{
+    switch (op) {
+    case VW_AND: return _mm256_and_si256(a, b);
+    case VW_OR:  return _mm256_or_si256(a, b);
+    case VW_XOR: return _mm256_xor_si256(a, b);
+    default:     return a;
+    }
+}
+
+static inline uint64_t
+op_64(enum view_op op, uint64_t a, uint64_t b)
+{
+    switch (op) {
+    case VW_AND: return a & b;
+    case VW_OR:  return a | b;
+    case VW_XOR: return a ^ b;
+    default:     return a;
+    }
+}
+
+static void
+view_op(struct bit_vector* dst, const struct bit_view* vs, int v_num,
+        enum view_op op)
+{
+    assert(v_num > 0);
+    elem_t size = vs[0].size;
+    for (int j = 1; j < v_num; ++j)
+        size = min(size, vs[j].size);
+    assert(dst->size >= size);
+
+    uint8_t* arr = dst->arr;
+    __m256i ones = _mm256_set1_epi8(-1);
+    elem_t bit = 0;
+    for (; bit + 256 <= size; bit += 256) {
+        bool fits = true;
+        for (int j = 0; j < v_num; ++j)
+            fits &= chunk_fits(&vs[j], bit);
+        if (!fits) break;
+        __m256i r = load_256(&vs[0], bit);
+        for (int j = 1; j < v_num; ++j)
+            r = op_256(op, r, load_256(&vs[j], bit));
+        if (op == VW_NOT) r = _mm256_xor_si256(r, ones);
+        _mm256_store_si256((__m256i*) (arr + (bit >> 3)), r);
+    }
+    for (; bit < size; bit += 64) {
+        uint64_t r = load_64(&vs[0], bit);
+        for (int j = 1; j < v_num; ++j)
+            r = op_64(op, r, load_64(&vs[j], bit));
+        if (op == VW_NOT) r = ~r;
+        // longer operands have bits past size in the last word
+        if (size - bit < 64) r &= (1ULL << (size - bit)) - 1;
+        memcpy(arr + (bit >> 3), &r, 8);
+    }
+    memset(arr + (bit >> 3), 0, dst->allocated - (bit >> 3));
+}
+
+void
+vw_copy(struct bit_vector* dst, struct bit_view v)
+{
+    view_op(dst, &v, 1, VW_COPY);
+}
+
+void
+vw_not(struct bit_vector* dst, struct bit_view v)
+{
+    view_op(dst, &v, 1, VW_NOT);
+}
+
+void
+vw_and(struct bit_vector* dst, struct bit_view v1, struct bit_view v2)
+{
+    struct bit_view vs[2] = { v1, v2 };
+    view_op(dst, vs, 2, VW_AND);
+}
+
+void
+vw_or(struct bit_vector* dst, struct bit_view v1, struct bit_view v2)
+{
+    struct bit_view vs[2] = { v1, v2 };
+    view_op(dst, vs, 2, VW_OR);
+}
+
+void
+vw_xor(struct bit_vector* dst, struct bit_view v1, struct bit_view v2)
+{
+    struct bit_view vs[2] = { v1, v2 };
+    view_op(dst, vs, 2, VW_XOR);
+}
+
+void
+vw_multiple_and(struct bit_vector* dst, const struct bit_view* vs, int v_num)
+{
+    view_op(dst, vs, v_num, VW_AND);
+}
+
+elem_t
+vw_popcount(struct bit_view v)
+{
+    __m256i acc = _mm256_setzero_si256();
+    elem_t bit = 0;
+    for (; chunk_fits(&v, bit); bit += 256)
+        acc = _mm256_add_epi64(acc, popcount_epi64_256(load_256(&v, bit)));
+    elem_t count = hsum_epi64_256(acc);
+    for (; bit < v.size; bit += 64)
+        count += __builtin_popcountll(load_64(&v, bit));
+    return count;
+}
+
+int64_t
+vw_ffs(struct bit_view v)
+{
+    return vw_find_next(v, 0);
+}
+
+int64_t
+vw_find_next(struct bit_view v, elem_t from)
+{
+    elem_t bit = from;
+    for (; chunk_fits(&v, bit); bit += 256) {
+        __m256i x = load_256(&v, bit);
+        if (_mm256_testz_si256(x, x)) continue;
+        uint64_t w[4];
+        _mm256_storeu_si256((__m256i*) w, x);
+        for (int k = 0; k < 4; ++k) {
+            if (w[k]) return bit + (k << 6) + __builtin_ctzll(w[k]);
+        }
+    }
+    for (; bit < v.size; bit += 64) {
+        uint64_t w = load_64(&v, bit);
+        if (w) return bit + __builtin_ctzll(w);
+    }
+    return -1;
+}
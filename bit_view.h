@@ -0,0 +1,100 @@
+/**
+ *  bit_view.h
+ *
+ *  Zero-copy views over a bit range of an existing vector, so that a
+ *  region (one tenant's rules inside a large vector, say) can be ANDed,
+ *  counted and scanned without copying it into a vector of its own.
+ *
+ *  A view is plain data and never owns memory; it stays valid as long as
+ *  the vector it was taken from.  Views starting on a byte boundary are
+ *  read with plain unaligned loads, others with shifted SIMD loads.  Ops
+ *  write their result to bit 0 onwards of an ordinary dst vector.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef BIT_VIEW_H
+#define BIT_VIEW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct bit_view {
+    const uint8_t* arr;
+    // first bit inside arr[0], 0..7
+    int offset;
+    // bit length
+    elem_t size;
+};
+
+static inline struct bit_view
+vw_of(struct bit_vector* bv, elem_t from, elem_t len)
+{
+    assert(from + len <= bv->size);
+    struct bit_view v = { bv->arr + (from >> 3), (int) (from & 7), len };
+    return v;
+}
+
+static inline struct bit_view
+vw_sub(struct bit_view v, elem_t from, elem_t len)
+{
+    assert(from + len <= v.size);
+    from += v.offset;
+    struct bit_view s = { v.arr + (from >> 3), (int) (from & 7), len };
+    return s;
+}
+
+static inline bool
+vw_value(struct bit_view v, elem_t i)
+{
+    assert(i < v.size);
+    i += v.offset;
+    return (v.arr[i >> 3] >> (i & 7)) & 1;
+}
+
+/**
+ * Bulk ops over the shortest operand's length.  dst must hold at least
+ * that many bits; its bits past them are cleared.
+ */
+void
+vw_copy(struct bit_vector* dst, struct bit_view v);
+
+void
+vw_not(struct bit_vector* dst, struct bit_view v);
+
+void
+vw_and(struct bit_vector* dst, struct bit_view v1, struct bit_view v2);
+
+void
+vw_or(struct bit_vector* dst, struct bit_view v1, struct bit_view v2);
+
+void
+vw_xor(struct bit_vector* dst, struct bit_view v1, struct bit_view v2);
+
+void
+vw_multiple_and(struct bit_vector* dst, const struct bit_view* vs, int v_num);
+
+elem_t
+vw_popcount(struct bit_view v);
+
+// first set bit, relative to the view, -1 if none
+int64_t
+vw_ffs(struct bit_view v);
+
+/**
+ * First set bit at or after from, -1 if none.  Iterate with
+ *   for (int64_t i = vw_ffs(v); i >= 0; i = vw_find_next(v, i + 1))
+ */
+int64_t
+vw_find_next(struct bit_view v, elem_t from);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
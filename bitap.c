@@ -0,0 +1,269 @@
+/**
+ *  bitap.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "bitap.h"
+
+#ifdef __AVX512F__
+#define REG_BYTES 64
+#else
+#define REG_BYTES 32
+#endif
+#define REG_WORDS (REG_BYTES / 8)
+
+// step_reg() results
+#define STEP_LIVE 1
+#define STEP_HIT 2
+#define STEP_TOP 4
+
+/**
+ * One register of (D << 1) | I masked with B[c]; cin is the top bit of
+ * the register below.  Returns STEP_LIVE if the result is nonzero, plus
+ * STEP_HIT if it has a final bit set and STEP_TOP if its top bit is set.
+ */
+static inline int
+step_reg(uint8_t* d, const uint8_t* init, const uint8_t* mask,
+         const uint8_t* final, uint64_t cin)
+{
+#ifdef __AVX512F__
+    __m512i v = _mm512_load_si512((__m512i*) d);
+    // lane i takes the top bit of lane i - 1, lane 0 takes cin
+    __m512i lo = _mm512_alignr_epi64(v, _mm512_set1_epi64(cin << 63), 7);
+    __m512i s = _mm512_or_si512(_mm512_slli_epi64(v, 1),
+                                _mm512_srli_epi64(lo, 63));
+    s = _mm512_or_si512(s, _mm512_load_si512((__m512i*) init));
+    s = _mm512_and_si512(s, _mm512_load_si512((__m512i*) mask));
+    _mm512_store_si512((__m512i*) d, s);
+    if (!_mm512_test_epi64_mask(s, s)) return 0;
+    return STEP_LIVE |
+        (_mm512_test_epi64_mask(s, _mm512_load_si512((__m512i*) final)) ?
+         STEP_HIT : 0) |
+        (_mm512_test_epi64_mask(s, _mm512_set1_epi64(1ULL << 63)) & 0x80 ?
+         STEP_TOP : 0);
+#else
+    __m256i v = _mm256_load_si256((__m256i*) d);
+    __m256i top = _mm256_permute4x64_epi64(_mm256_srli_epi64(v, 63), 0x93);
+    top = _mm256_blend_epi32(top, _mm256_set1_epi64x(cin), 0x03);
+    __m256i s = _mm256_or_si256(_mm256_slli_epi64(v, 1), top);
+    s = _mm256_or_si256(s, _mm256_load_si256((__m256i*) init));
+    s = _mm256_and_si256(s, _mm256_load_si256((__m256i*) mask));
+    _mm256_store_si256((__m256i*) d, s);
+    if (_mm256_testz_si256(s, s)) return 0;
+    return STEP_LIVE |
+        (_mm256_testz_si256(s, _mm256_load_si256((__m256i*) final)) ?
+         0 : STEP_HIT) |
+        (_mm256_movemask_pd(_mm256_castsi256_pd(s)) & 8 ? STEP_TOP : 0);
+#endif
+}
+
+struct bitap*
+ba_create(const uint8_t** patterns, const elem_t* lens, int num)
+{
+    if (num <= 0) return NULL;
+    elem_t bits = 0;
+    for (int p = 0; p < num; ++p) {
+        if (lens[p] == 0) return NULL;
+        bits += lens[p];
+    }
+
+    struct bitap* ba = (struct bitap*) calloc(1, sizeof(*ba));
+    if (ba == NULL) return NULL;
+    ba->num = num;
+    ba->bits = bits;
+    ba->regs = (bits + REG_BYTES * 8 - 1) / (REG_BYTES * 8);
+    ba->mwords = (ba->regs + 63) / 64;
+    ba->first = (elem_t*) malloc((num + 1) * sizeof(elem_t));
+    ba->active = (uint64_t*) calloc(ba->mwords, sizeof(uint64_t));
+    ba->tops = (uint64_t*) calloc(ba->mwords, sizeof(uint64_t));
+    ba->starts = (uint64_t*) calloc(256 * ba->mwords, sizeof(uint64_t));
+    ba->state = bv_create(bits);
+    ba->init = bv_create(bits);
+    ba->final = bv_create(bits);
+    if (!ba->first || !ba->active || !ba->tops || !ba->starts ||
+        !ba->state || !ba->init || !ba->final)
+        goto err;
+    for (int c = 0; c < 256; ++c) {
+        ba->masks[c] = bv_create(bits);
+        if (ba->masks[c] == NULL) goto err;
+    }
+
+    elem_t s = 0;
+    for (int p = 0; p < num; ++p) {
+        ba->first[p] = s;
+        bv_set(ba->init, s, true);
+        bv_set(ba->final, s + lens[p] - 1, true);
+        for (elem_t j = 0; j < lens[p]; ++j)
+            bv_set(ba->masks[patterns[p][j]], s + j, true);
+        uint8_t c = patterns[p][0];
+        elem_t r = s / (REG_BYTES * 8);
+        ba->starts[c * ba->mwords + r / 64] |= 1ULL << (r & 63);
+        ba->lead[c] = true;
+        if (c < 128) ba->lead_lo[c & 15] |= 1 << (c >> 4);
+        else ba->lead_hi[c & 15] |= 1 << ((c >> 4) & 7);
+        s += lens[p];
+    }
+    ba->first[num] = bits;
+    return ba;
+
+err:
+    ba_destroy(ba);
+    return NULL;
+}
+
+void
+ba_destroy(struct bitap* ba)
+{
+    for (int c = 0; c < 256; ++c)
+        if (ba->masks[c]) bv_destroy(ba->masks[c]);
+    if (ba->final) bv_destroy(ba->final);
+    if (ba->init) bv_destroy(ba->init);
+    if (ba->state) bv_destroy(ba->state);
+    free(ba->starts);
+    free(ba->tops);
+    free(ba->active);
+    free(ba->first);
+    free(ba);
+}
+
+void
+ba_reset(struct bitap* ba)
+{
+    memset(ba->state->arr, 0, ba->state->allocated);
+    memset(ba->active, 0, ba->mwords * sizeof(uint64_t));
+    memset(ba->tops, 0, ba->mwords * sizeof(uint64_t));
+    ba->pos = 0;
+}
+
+// pattern owning state bit b
+static int
+owner(struct bitap* ba, elem_t b)
+{
+    int lo = 0, hi = ba->num - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (ba->first[mid] <= b) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+// records the patterns ending in register r after the byte at offset end
+static elem_t
+report(struct bitap* ba, elem_t r, elem_t end,
+       struct ba_match* out, elem_t max_out, elem_t found)
+{
+    const uint64_t* d = (uint64_t*) ba->state->arr + r * REG_WORDS;
+    const uint64_t* f = (uint64_t*) ba->final->arr + r * REG_WORDS;
+    for (int w = 0; w < REG_WORDS; ++w) {
+        uint64_t m = d[w] & f[w];
+        while (m) {
+            elem_t b = (r * REG_WORDS + w) * 64 + __builtin_ctzll(m);
+            m &= m - 1;
+            if (found < max_out) {
+                out[found].pattern = owner(ba, b);
+                out[found].end = end;
+            }
+            found++;
+        }
+    }
+    return found;
+}
+
+// first t' >= t with text[t'] a lead byte, len if none
+static elem_t
+next_lead(struct bitap* ba, const uint8_t* text, elem_t t, elem_t len)
+{
+    const __m256i lo = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i*) ba->lead_lo));
+    const __m256i hi = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((__m128i*) ba->lead_hi));
+    const __m256i bits = _mm256_setr_epi8(
+        1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+        1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i sign = _mm256_set1_epi8(-128);
+    const __m256i low3 = _mm256_set1_epi8(7);
+    for (; t + 32 <= len; t += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i*) (text+t));
+        // vpshufb yields 0 for indices with the top bit set, so each
+        // table only answers for its half of the byte values
+        __m256i m = _mm256_or_si256(_mm256_shuffle_epi8(lo, v),
+            _mm256_shuffle_epi8(hi, _mm256_xor_si256(v, sign)));
+        __m256i h = _mm256_and_si256(_mm256_srli_epi16(v, 4), low3);
+        m = _mm256_and_si256(m, _mm256_shuffle_epi8(bits, h));
+        uint32_t lead = ~(uint32_t) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+        if (lead) return t + __builtin_ctz(lead);
+    }
+    while (t < len && !ba->lead[text[t]]) ++t;
+    return t;
+}
+
+elem_t
+ba_scan(struct bitap* ba, const uint8_t* text, elem_t len,
+        struct ba_match* out, elem_t max_out)
+{
+    elem_t mw = ba->mwords, found = 0;
+    uint64_t *act = ba->active, *tops = ba->tops;
+    uint64_t cand[mw];
+    // the bit past the last register, reached by act << 1
+    uint64_t valid = (ba->regs & 63) ? (1ULL << (ba->regs & 63)) - 1 : ~0ULL;
+    bool busy = false;
+    for (elem_t k = 0; k < mw; ++k) busy |= act[k] != 0;
+
+    for (elem_t t = 0; t < len; ++t) {
+        // nothing alive: skip to the next byte that can begin a pattern
+        if (!busy) {
+            t = next_lead(ba, text, t, len);
+            if (t == len) break;
+        }
+        uint8_t c = text[t];
+        const uint64_t* st = ba->starts + c * mw;
+        const uint8_t* mask = ba->masks[c]->arr;
+        uint64_t carry = 0;
+        for (elem_t k = 0; k < mw; ++k) {
+            cand[k] = act[k] | (act[k] << 1) | carry | st[k];
+            carry = act[k] >> 63;
+        }
+        cand[mw - 1] &= valid;
+
+        // high registers first, each takes the old top bit of the one
+        // below as its carry
+        busy = false;
+        for (elem_t k = mw; k-- > 0; ) {
+            uint64_t m = cand[k], nact = 0, ntops = 0;
+            uint64_t below = (tops[k] << 1) | (k ? tops[k - 1] >> 63 : 0);
+            while (m) {
+                int b = 63 - __builtin_clzll(m);
+                m &= ~(1ULL << b);
+                elem_t r = k * 64 + b;
+                elem_t off = r * REG_BYTES;
+                int res = step_reg(ba->state->arr + off, ba->init->arr + off,
+                                   mask + off, ba->final->arr + off,
+                                   (below >> b) & 1);
+                if (!res) continue;
+                nact |= 1ULL << b;
+                if (res & STEP_TOP) ntops |= 1ULL << b;
+                if (unlikely(res & STEP_HIT))
+                    found = report(ba, r, ba->pos + t, out, max_out, found);
+            }
+            act[k] = nact;
+            tops[k] = ntops;
+            busy |= nact != 0;
+        }
+    }
+    ba->pos += len;
+    return found;
+}
@@ -0,0 +1,91 @@
+/**
+ *  bitap.h
+ *
+ *  Shift-And (bitap) matching of many patterns of any length at once.
+ *  The patterns are laid end to end in one long state vector, one bit
+ *  per pattern position, and each input byte c advances every pattern
+ *  with
+ *
+ *      D = ((D << 1) | I) & B[c]
+ *
+ *  where I holds the first bit of every pattern and B[c] the positions
+ *  whose pattern byte is c.  B[c], I and the final-bit mask are kept as
+ *  bit_vectors.  The state is stepped a SIMD register (256 bits, 512 with
+ *  AVX-512) at a time with a carry between registers, and only registers
+ *  holding a live partial match or a possible start for c are touched,
+ *  so the cost per byte follows the live matches, not the total length.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef BITAP_H
+#define BITAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ba_match {
+    // index of the pattern in the ba_create() arguments
+    int pattern;
+    // stream offset of the last byte of the match
+    elem_t end;
+};
+
+struct bitap {
+    int num;
+    // state length, the sum of the pattern lengths
+    elem_t bits;
+    // SIMD registers spanned by the state, and 64-bit words in a
+    // bitmap with one bit per register
+    elem_t regs;
+    elem_t mwords;
+    // bytes scanned since the last reset
+    elem_t pos;
+    // first state bit of each pattern, first[num] = bits
+    elem_t* first;
+    // registers with a nonzero state, and with their top bit set
+    uint64_t* active;
+    uint64_t* tops;
+    // starts[c * mwords + k]: registers where a pattern begins with c
+    uint64_t* starts;
+    // bytes that begin some pattern, also as nibble tables for SIMD
+    // lookups: bit h of lead_lo[l] (lead_hi[l]) is set when byte h l
+    // (8 + h, l) in hex is a lead byte
+    bool lead[256];
+    uint8_t lead_lo[16];
+    uint8_t lead_hi[16];
+    struct bit_vector* state;
+    struct bit_vector* init;
+    struct bit_vector* final;
+    struct bit_vector* masks[256];
+};
+
+// NULL if num is 0 or a pattern is empty
+struct bitap*
+ba_create(const uint8_t** patterns, const elem_t* lens, int num);
+
+void
+ba_destroy(struct bitap* ba);
+
+// forgets partial matches and restarts stream offsets at 0
+void
+ba_reset(struct bitap* ba);
+
+/**
+ * Feeds the next len bytes of the stream; matches may span calls.
+ * Writes the first max_out matches, ordered by end, to out and returns
+ * the number found, which may exceed max_out.
+ */
+elem_t
+ba_scan(struct bitap* ba, const uint8_t* text, elem_t len,
+        struct ba_match* out, elem_t max_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,303 @@
+/**
+ *  bitmap_index.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "bitmap_index.h"
+
+enum pass_op {
+    OP_COPY,
+    OP_AND,
+    OP_OR,
+    // a & ~b
+    OP_ANDNOT,
+};
+
+static inline void
+set_bit(struct bit_vector* bv, elem_t i)
+{
+    bv->arr[i >> 3] |= 1 << (i & 7);
+}
+
+// clears dst from bit rows on, restoring the zero padding invariant
+static void
+clear_tail(struct bit_vector* dst, elem_t rows)
+{
+    elem_t byte = rows >> 3;
+    if (rows & 7) dst->arr[byte++] &= (1 << (rows & 7)) - 1;
+    memset(dst->arr + byte, 0, dst->allocated - byte);
+}
+
+static inline __m256i
+apply(enum pass_op op, __m256i a, __m256i b)
+{
+    switch (op) {
+    case OP_AND:    return _mm256_and_si256(a, b);
+    case OP_OR:     return _mm256_or_si256(a, b);
+    case OP_ANDNOT: return _mm256_andnot_si256(b, a);
+    default:        return a;
+    }
+}
+
+// dst = [~](a op b) over count bytes, one pass
+static void
+pass2(uint8_t* dst, elem_t count, enum pass_op op, bool negate,
+      const uint8_t* a, const uint8_t* b)
+{
+    __m256i flip = negate ? _mm256_set1_epi8(-1) : _mm256_setzero_si256();
+    for (elem_t i = 0; i < count; i += 32) {
+        __m256i va = _mm256_load_si256((__m256i*) (a+i));
+        __m256i vb = op == OP_COPY ? va : _mm256_load_si256((__m256i*) (b+i));
+        __m256i r = _mm256_xor_si256(apply(op, va, vb), flip);
+        _mm256_store_si256((__m256i*) (dst+i), r);
+    }
+}
+
+// dst = [~](OR of arrs), one pass over all operands
+static void
+or_pass(uint8_t* dst, elem_t count, bool negate,
+        const uint8_t** arrs, int n)
+{
+    __m256i flip = negate ? _mm256_set1_epi8(-1) : _mm256_setzero_si256();
+    for (elem_t i = 0; i < count; i += 64) {
+        __m256i r0 = _mm256_setzero_si256();
+        __m256i r1 = _mm256_setzero_si256();
+        for (int j = 0; j < n; ++j) {
+            r0 = _mm256_or_si256(r0, _mm256_load_si256((__m256i*) (arrs[j]+i)));
+            r1 = _mm256_or_si256(r1, _mm256_load_si256((__m256i*) (arrs[j]+i+32)));
+        }
+        _mm256_store_si256((__m256i*) (dst+i), _mm256_xor_si256(r0, flip));
+        _mm256_store_si256((__m256i*) (dst+i+32), _mm256_xor_si256(r1, flip));
+    }
+}
+
+/**
+ * x < bound of one slice block, most significant slice first (O'Neil and
+ * Quass): lt collects rows that fell below at a 0 bit of the bound, eq the
+ * rows still equal so far.
+ */
+static inline __m256i
+slice_lt(struct bitmap_index* bi, uint64_t bound, elem_t i)
+{
+    if (bound >> bi->num) return _mm256_set1_epi8(-1);
+    if (bound == 0) return _mm256_setzero_si256();
+    __m256i lt = _mm256_setzero_si256();
+    __m256i eq = _mm256_set1_epi8(-1);
+    for (int s = bi->num - 1; s >= 0; --s) {
+        __m256i v = _mm256_load_si256((__m256i*) (bi->bvs[s]->arr+i));
+        if ((bound >> s) & 1) {
+            lt = _mm256_or_si256(lt, _mm256_andnot_si256(v, eq));
+            eq = _mm256_and_si256(eq, v);
+        } else {
+            eq = _mm256_andnot_si256(v, eq);
+        }
+    }
+    return lt;
+}
+
+static void
+sliced_range(struct bitmap_index* bi, uint64_t lo, uint64_t hi,
+             struct bit_vector* dst)
+{
+    elem_t count = bi->bvs[0]->allocated;
+    for (elem_t i = 0; i < count; i += 32) {
+        __m256i r = _mm256_andnot_si256(slice_lt(bi, lo, i),
+                                        slice_lt(bi, hi, i));
+        _mm256_store_si256((__m256i*) (dst->arr+i), r);
+    }
+}
+
+static void
+equality_range(struct bitmap_index* bi, uint64_t a, uint64_t b,
+               struct bit_vector* dst)
+{
+    elem_t count = ROUNDUP256(ROUNDUP8(bi->rows) >> 3);
+    uint64_t ins = b - a + 1;
+    // OR whichever side of the predicate has fewer vectors
+    bool negate = ins > bi->card - ins;
+    // the smaller side has at most card / 2 vectors, which bi->ops holds
+    const uint8_t** arrs = bi->ops;
+    int n = 0;
+    for (uint64_t v = 0; v < bi->card; ++v) {
+        if ((v >= a && v <= b) != negate) arrs[n++] = bi->bvs[v]->arr;
+    }
+    or_pass(dst->arr, count, negate, arrs, n);
+}
+
+static void
+range_range(struct bitmap_index* bi, uint64_t a, uint64_t b,
+            struct bit_vector* dst)
+{
+    elem_t count = ROUNDUP256(ROUNDUP8(bi->rows) >> 3);
+    if (a == 0 && b == bi->card - 1) {
+        memset(dst->arr, 0xff, count);
+    } else if (a == 0) {
+        pass2(dst->arr, count, OP_COPY, false, bi->bvs[b]->arr, NULL);
+    } else if (b == bi->card - 1) {
+        pass2(dst->arr, count, OP_COPY, true, bi->bvs[a-1]->arr, NULL);
+    } else {
+        pass2(dst->arr, count, OP_ANDNOT, false,
+              bi->bvs[b]->arr, bi->bvs[a-1]->arr);
+    }
+}
+
+/**
+ * [a, b] from the I[j] = [j, j + m - 1] vectors, j in [0, card - m]
+ * (Chan and Ioannidis): always one vector or two combined in one pass.
+ */
+static void
+interval_range(struct bitmap_index* bi, uint64_t a, uint64_t b,
+               struct bit_vector* dst)
+{
+    elem_t count = ROUNDUP256(ROUNDUP8(bi->rows) >> 3);
+    uint64_t card = bi->card, m = (card + 1) >> 1, len = b - a + 1;
+    struct bit_vector** I = bi->bvs;
+    if (len == card) {
+        memset(dst->arr, 0xff, count);
+    } else if (len == m) {
+        pass2(dst->arr, count, OP_COPY, false, I[a]->arr, NULL);
+    } else if (len > m) {
+        pass2(dst->arr, count, OP_OR, false, I[a]->arr, I[b-m+1]->arr);
+    } else if (a <= card - m && b + 1 >= m) {
+        pass2(dst->arr, count, OP_AND, false, I[a]->arr, I[b-m+1]->arr);
+    } else if (b + 1 < m) {
+        pass2(dst->arr, count, OP_ANDNOT, false, I[a]->arr, I[b+1]->arr);
+    } else {
+        pass2(dst->arr, count, OP_ANDNOT, false, I[b-m+1]->arr, I[a-m]->arr);
+    }
+}
+
+void
+bi_range(struct bitmap_index* bi, uint64_t lo, uint64_t hi,
+         struct bit_vector* dst)
+{
+    assert(dst->size >= bi->rows);
+    hi = min(hi, bi->card);
+    if (lo >= hi) {
+        memset(dst->arr, 0, dst->allocated);
+        return;
+    }
+    switch (bi->enc) {
+    case BI_EQUALITY: equality_range(bi, lo, hi - 1, dst); break;
+    case BI_RANGE:    range_range(bi, lo, hi - 1, dst); break;
+    case BI_INTERVAL: interval_range(bi, lo, hi - 1, dst); break;
+    default:          sliced_range(bi, lo, hi, dst); break;
+    }
+    clear_tail(dst, bi->rows);
+}
+
+void
+bi_equal(struct bitmap_index* bi, uint32_t value, struct bit_vector* dst)
+{
+    bi_range(bi, value, (uint64_t) value + 1, dst);
+}
+
+static int
+vector_num(enum bi_encoding enc, uint64_t card)
+{
+    switch (enc) {
+    case BI_EQUALITY: return card;
+    case BI_RANGE:    return card - 1;
+    case BI_INTERVAL: return card - ((card + 1) >> 1) + 1;
+    default:          return card > 1 ? 64 - __builtin_clzll(card - 1) : 1;
+    }
+}
+
+// the interval vectors as sliding window ORs over the equality vectors
+static bool
+build_interval(struct bitmap_index* bi, const uint32_t* column)
+{
+    struct bitmap_index* eq = bi_build(column, bi->rows, BI_EQUALITY);
+    if (eq == NULL) return false;
+    uint64_t m = (bi->card + 1) >> 1;
+    elem_t count = bi->bvs[0]->allocated;
+    // m = ceil(card / 2) fits in the card / 2 + 1 slots of eq->ops
+    const uint8_t** arrs = eq->ops;
+    for (uint64_t v = 0; v < m; ++v) arrs[v] = eq->bvs[v]->arr;
+    or_pass(bi->bvs[0]->arr, count, false, arrs, m);
+    for (int j = 1; j < bi->num; ++j) {
+        uint8_t* cur = bi->bvs[j]->arr;
+        pass2(cur, count, OP_ANDNOT, false, bi->bvs[j-1]->arr, eq->bvs[j-1]->arr);
+        pass2(cur, count, OP_OR, false, cur, eq->bvs[j+m-1]->arr);
+    }
+    bi_destroy(eq);
+    return true;
+}
+
+struct bitmap_index*
+bi_build(const uint32_t* column, elem_t rows, enum bi_encoding enc)
+{
+    uint32_t top = 0;
+    for (elem_t r = 0; r < rows; ++r)
+        top = max(top, column[r]);
+    uint64_t card = (uint64_t) top + 1;
+    if (enc != BI_BITSLICED && card > BI_MAX_CARD) return NULL;
+
+    int num = vector_num(enc, card);
+    struct bitmap_index* bi = (struct bitmap_index*)
+        calloc(1, sizeof(struct bitmap_index) + sizeof(struct bit_vector*) * num);
+    if (bi == NULL) return NULL;
+    bi->enc = enc;
+    bi->card = card;
+    bi->rows = rows;
+    bi->num = num;
+    if (enc == BI_EQUALITY) {
+        bi->ops = (const uint8_t**) malloc(sizeof(uint8_t*) * (card / 2 + 1));
+        if (bi->ops == NULL) goto err;
+    }
+    for (int i = 0; i < num; ++i) {
+        bi->bvs[i] = bv_create(rows);
+        if (bi->bvs[i] == NULL) goto err;
+    }
+
+    switch (enc) {
+    case BI_EQUALITY:
+        for (elem_t r = 0; r < rows; ++r)
+            set_bit(bi->bvs[column[r]], r);
+        break;
+    case BI_RANGE:
+        // equality first, then R[v] = R[v - 1] | E[v]
+        for (elem_t r = 0; r < rows; ++r) {
+            if (column[r] < card - 1) set_bit(bi->bvs[column[r]], r);
+        }
+        for (int v = 1; v < num; ++v)
+            bv_or_with_dst(bi->bvs[v], bi->bvs[v], bi->bvs[v-1]);
+        break;
+    case BI_INTERVAL:
+        if (!build_interval(bi, column)) goto err;
+        break;
+    case BI_BITSLICED:
+        for (elem_t r = 0; r < rows; ++r) {
+            for (uint32_t x = column[r]; x; x &= x - 1)
+                set_bit(bi->bvs[__builtin_ctz(x)], r);
+        }
+        break;
+    }
+    return bi;
+
+err:
+    bi_destroy(bi);
+    return NULL;
+}
+
+void
+bi_destroy(struct bitmap_index* bi)
+{
+    for (int i = 0; i < bi->num; ++i) {
+        if (bi->bvs[i]) bv_destroy(bi->bvs[i]);
+    }
+    free(bi->ops);
+    free(bi);
+}
@@ -0,0 +1,79 @@
+/**
+ *  bitmap_index.h
+ *
+ *  Bitmap index over a uint32_t column.  Values are taken as a domain
+ *  [0, card) with card = max + 1, and encoded as one of
+ *
+ *    BI_EQUALITY  card vectors,       E[v] = (x == v)
+ *    BI_RANGE     card - 1 vectors,   R[v] = (x <= v)
+ *    BI_INTERVAL  card - m + 1,       I[j] = (j <= x < j + m), m = ceil(card/2)
+ *    BI_BITSLICED log2(card) vectors, B[i] = bit i of x
+ *
+ *  Range and interval encoded indexes answer any range predicate from at
+ *  most two vectors in a single bulk pass; equality encoding ORs the
+ *  shorter side of the predicate.  Bit-slicing keeps high cardinality
+ *  columns small and evaluates both bounds in one pass over the slices.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef BITMAP_INDEX_H
+#define BITMAP_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// largest card the per-value encodings accept; use BI_BITSLICED above it
+#define BI_MAX_CARD (1U << 16)
+
+enum bi_encoding {
+    BI_EQUALITY,
+    BI_RANGE,
+    BI_INTERVAL,
+    BI_BITSLICED,
+};
+
+struct bitmap_index {
+    enum bi_encoding enc;
+    // values are in [0, card)
+    uint64_t card;
+    // indexed rows, the bit length of every vector
+    elem_t rows;
+    int num;
+    // equality only: card / 2 + 1 operand pointers gathered per query
+    const uint8_t** ops;
+    struct bit_vector* bvs[0];
+};
+
+/**
+ * Builds an index over column[0..rows).  Returns NULL on allocation
+ * failure or if card exceeds BI_MAX_CARD for a per-value encoding.
+ */
+struct bitmap_index*
+bi_build(const uint32_t* column, elem_t rows, enum bi_encoding enc);
+
+void
+bi_destroy(struct bitmap_index* bi);
+
+/**
+ * dst = rows with lo <= x < hi.  dst must hold at least bi->rows bits,
+ * its bits past that are cleared.  An equality encoded index gathers its
+ * operands in bi->ops, so queries on one such index must not overlap.
+ */
+void
+bi_range(struct bitmap_index* bi, uint64_t lo, uint64_t hi,
+         struct bit_vector* dst);
+
+// dst = rows with x == value
+void
+bi_equal(struct bitmap_index* bi, uint32_t value, struct bit_vector* dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
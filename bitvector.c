@@ -11,6 +11,8 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <unistd.h>
+#include <time.h>
 #include <immintrin.h>
 #include <emmintrin.h>
 #include <xmmintrin.h>
@@ -19,10 +21,118 @@
 #include "bit_utils.h"
 #include "bitvector.h"
 #include "prefetch.h"
+#include "simd_utils.h"
+#include "bv_stats.h"
 
-#define bv_malloc malloc
 #define bv_free free
 
+static inline void*
+bv_malloc(size_t size)
+{
+    void* p;
+    // arr is accessed with aligned SIMD loads/stores and is expected to
+    // start on a cache line
+    if (posix_memalign(&p, 64, size)) return NULL;
+    return p;
+}
+
+/**
+ * Outputs at least this large are written with non-temporal stores so
+ * they do not evict the operands and the caller's hot data from the LLC.
+ * 0 means "not detected yet".  Kernels on any thread read it, so it is
+ * only accessed atomically; racing detections store the same value.
+ */
+static size_t stream_threshold = 0;
+
+static size_t
+detect_llc_size(void)
+{
+    long size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (size <= 0) size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (size <= 0) size = 8L << 20;
+    return (size_t) size;
+}
+
+size_t
+bv_stream_threshold(void)
+{
+    size_t bytes = __atomic_load_n(&stream_threshold, __ATOMIC_RELAXED);
+    if (unlikely(bytes == 0)) {
+        // the output competes with at least two operands for the LLC
+        bytes = detect_llc_size() / 2;
+        __atomic_store_n(&stream_threshold, bytes, __ATOMIC_RELAXED);
+    }
+    return bytes;
+}
+
+void
+bv_set_stream_threshold(size_t bytes)
+{
+    __atomic_store_n(&stream_threshold, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * How far ahead (in bytes) the bulk kernels prefetch every operand
+ * stream.  Hardware prefetchers track a limited number of streams, so
+ * with many operands on distinct pages software prefetch keeps DRAM busy.
+ */
+static elem_t prefetch_distance = BV_PREFETCH_DISTANCE;
+
+elem_t
+bv_prefetch_distance(void)
+{
+    return __atomic_load_n(&prefetch_distance, __ATOMIC_RELAXED);
+}
+
+void
+bv_set_prefetch_distance(elem_t bytes)
+{
+    __atomic_store_n(&prefetch_distance, ROUNDUP64(bytes), __ATOMIC_RELAXED);
+}
+
+// last offset (exclusive) at which prefetching ahead stays inside arr
+static inline elem_t
+prefetch_end(elem_t count, elem_t dist)
+{
+    return (dist && dist < count) ? count - dist : 0;
+}
+
+enum bulk_op {
+    BULK_AND,
+    BULK_OR,
+    BULK_XOR,
+};
+
+static inline __m256i
+bulk_op_256(enum bulk_op op, __m256i v1, __m256i v2)
+{
+    switch (op) {
+    case BULK_AND: return _mm256_and_si256(v1, v2);
+    case BULK_OR:  return _mm256_or_si256(v1, v2);
+    default:       return _mm256_xor_si256(v1, v2);
+    }
+}
+
+static inline void
+bulk_stream(enum bulk_op op, uint8_t* arr3,
+            const uint8_t* arr1, const uint8_t* arr2, elem_t count)
+{
+    elem_t dist = bv_prefetch_distance(), pf_end = prefetch_end(count, dist);
+    for (elem_t i = 0; i < count; i += 64) {
+        if (i < pf_end) {
+            rte_prefetch0((uint8_t*) arr1+i+dist);
+            rte_prefetch0((uint8_t*) arr2+i+dist);
+        }
+        __m256i v1 = _mm256_load_si256((__m256i*) (arr1+i));
+        __m256i v2 = _mm256_load_si256((__m256i*) (arr2+i));
+        __m256i v3 = _mm256_load_si256((__m256i*) (arr1+i+32));
+        __m256i v4 = _mm256_load_si256((__m256i*) (arr2+i+32));
+        _mm256_stream_si256((__m256i*) (arr3+i), bulk_op_256(op, v1, v2));
+        _mm256_stream_si256((__m256i*) (arr3+i+32), bulk_op_256(op, v3, v4));
+    }
+    _mm_sfence();
+}
+
 /*
 #ifdef __AVX2__
 #elif __SSE4_2__
@@ -59,19 +169,27 @@ bv_destroy(struct bit_vector* bv)
 void
 bv_prefetch(struct bit_vector* bv)
 {
+    bv_prefetch_range(bv, 0, bv->size);
+}
+
+void
+bv_prefetch_range(struct bit_vector* bv, elem_t from, elem_t len)
+{
+    if (len == 0) return;
+    assert(from + len <= bv->allocated << 3);
     uint8_t* arr = bv->arr;
-    rte_prefetch2(arr);
-    //elem_t allocated = bv->allocated;
-    //for (int i = 0; i < allocated; i += 8) 
-    //    rte_prefetch2(arr+i);
+    elem_t first = (from >> 3) & ~63UL;
+    elem_t last = (from + len - 1) >> 3;
+    for (elem_t i = first; i <= last; i += 64)
+        rte_prefetch2(arr+i);
 }
 
 void
 bv_set(struct bit_vector* bv, elem_t index, bool val)
 {
-    assert(index <= bv->size);
+    assert(index < bv->size);
     int bit_index = index & 7U;
-    int byte_index = index >> 3;
+    elem_t byte_index = index >> 3;
     int n = bv->arr[byte_index] & ~(1 << (bit_index));
     bv->arr[byte_index] = n | (val << (bit_index));
 }
@@ -79,8 +197,8 @@ bv_set(struct bit_vector* bv, elem_t index, bool val)
 bool
 bv_value(struct bit_vector* bv, elem_t index)
 {
-    assert(index <= bv->size);
-    return (bv->arr[(index >> 3)] >> (index & 7U));
+    assert(index < bv->size);
+    return (bv->arr[(index >> 3)] >> (index & 7U)) & 1;
 }
 
 struct bit_vector*
@@ -89,27 +207,171 @@ bv_not(struct bit_vector* bv1)
     struct bit_vector* bv2 = bv_create(bv1->size);
     if (bv2 == NULL) return NULL;
 
-    int count = bv1->size;
-    uint8_t *arr1 = bv1->arr;
-    uint8_t *arr2 = bv2->arr;
-    for (int i = 0; i < count; i++) {
-        arr2[i] = ~arr1[i];
-    }
+    bv_not_with_dst(bv2, bv1);
     return bv2;
 }
 
-int
+void
+bv_not_with_dst(struct bit_vector* dst, struct bit_vector* bv)
+{
+    BV_STATS_BEGIN();
+    uint8_t *arr1 = bv->arr;
+    uint8_t *arr2 = dst->arr;
+    elem_t count = dst->allocated;
+    __m256i ones = _mm256_set1_epi8(-1);
+    for (elem_t i = 0; i < count; i += 32) {
+        __m256i v = _mm256_load_si256((__m256i*) (arr1+i));
+        _mm256_store_si256((__m256i*) (arr2+i), _mm256_xor_si256(v, ones));
+    }
+
+    // keep the padding above size clear, the scans and popcount rely on it
+    elem_t byte = dst->size >> 3;
+    if (dst->size & 7) arr2[byte++] &= (1U << (dst->size & 7)) - 1;
+    memset(arr2 + byte, 0, count - byte);
+    BV_STATS_END(BV_OP_NOT, count);
+}
+
+/**
+ * Scans work on 64-bit words.  inv is 0 to look for set bits and ~0 to
+ * look for clear bits; words equal to inv are "empty".  Empty regions are
+ * skipped a 512-bit block per iteration.
+ */
+#define SCAN_BLOCK_WORDS 8
+
+// bit i of the result is set if word i of the block is not empty
+static inline uint32_t
+block_nonempty(const uint64_t* p, uint64_t inv)
+{
+#ifdef __AVX512F__
+    __m512i v = _mm512_loadu_si512((const void*) p);
+    return _mm512_cmpneq_epi64_mask(v, _mm512_set1_epi64(inv));
+#else
+    __m256i a = _mm256_load_si256((const __m256i*) p);
+    __m256i b = _mm256_load_si256((const __m256i*) (p + 4));
+    __m256i pat = _mm256_set1_epi64x(inv);
+    if (inv) {
+        if (_mm256_testc_si256(_mm256_and_si256(a, b), pat)) return 0;
+    } else {
+        __m256i o = _mm256_or_si256(a, b);
+        if (_mm256_testz_si256(o, o)) return 0;
+    }
+    uint32_t ea = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, pat)));
+    uint32_t eb = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(b, pat)));
+    return ~(ea | (eb << 4)) & 0xff;
+#endif
+}
+
+static inline int64_t
+scan_forward(const uint64_t* arr, elem_t nwords, elem_t from, uint64_t inv)
+{
+    elem_t w = from >> 6;
+    if (w >= nwords) return -1;
+    uint64_t cur = (arr[w] ^ inv) & (~0ULL << (from & 63));
+    if (cur) return (int64_t) ((w << 6) + __builtin_ctzll(cur));
+
+    for (w++; w < nwords && (w & (SCAN_BLOCK_WORDS - 1)); w++) {
+        cur = arr[w] ^ inv;
+        if (cur) return (int64_t) ((w << 6) + __builtin_ctzll(cur));
+    }
+    // nwords is a multiple of the block size, see bv_create()
+    for (; w < nwords; w += SCAN_BLOCK_WORDS) {
+        uint32_t mask = block_nonempty(arr + w, inv);
+        if (mask) {
+            w += __builtin_ctz(mask);
+            return (int64_t) ((w << 6) + __builtin_ctzll(arr[w] ^ inv));
+        }
+    }
+    return -1;
+}
+
+static inline int64_t
+scan_backward(const uint64_t* arr, elem_t from, uint64_t inv)
+{
+    int64_t w = from >> 6;
+    uint64_t cur = (arr[w] ^ inv) & (~0ULL >> (63 - (from & 63)));
+    if (cur) return (w << 6) + 63 - __builtin_clzll(cur);
+
+    for (w--; w >= 0 && ((w + 1) & (SCAN_BLOCK_WORDS - 1)); w--) {
+        cur = arr[w] ^ inv;
+        if (cur) return (w << 6) + 63 - __builtin_clzll(cur);
+    }
+    for (; w >= 0; w -= SCAN_BLOCK_WORDS) {
+        uint32_t mask = block_nonempty(arr + w - (SCAN_BLOCK_WORDS - 1), inv);
+        if (mask) {
+            w -= __builtin_clz(mask) - (32 - SCAN_BLOCK_WORDS);
+            return (w << 6) + 63 - __builtin_clzll(arr[w] ^ inv);
+        }
+    }
+    return -1;
+}
+
+int64_t
 bv_ffs(struct bit_vector* bv)
 {
-    int count = bv->allocated >> 3;
+    return bv_find_next(bv, 0);
+}
+
+int64_t
+bv_find_next(struct bit_vector* bv, elem_t from)
+{
+    if (from >= bv->size) return -1;
+    BV_STATS_BEGIN();
+    int64_t pos = scan_forward((uint64_t*) bv->arr, bv->allocated >> 3,
+                               from, 0);
+    BV_STATS_END(BV_OP_SCAN, ((pos < 0 ? bv->size : (elem_t) pos) - from) >> 3);
+    return (pos < 0 || (elem_t) pos >= bv->size) ? -1 : pos;
+}
+
+int64_t
+bv_fls(struct bit_vector* bv)
+{
+    if (bv->size == 0) return -1;
+    BV_STATS_BEGIN();
+    int64_t pos = scan_backward((uint64_t*) bv->arr, bv->size - 1, 0);
+    BV_STATS_END(BV_OP_SCAN, (bv->size - (pos < 0 ? 0 : (elem_t) pos)) >> 3);
+    return pos;
+}
+
+int64_t
+bv_ffz(struct bit_vector* bv)
+{
+    return bv_find_next_zero(bv, 0);
+}
+
+int64_t
+bv_find_next_zero(struct bit_vector* bv, elem_t from)
+{
+    if (from >= bv->size) return -1;
+    BV_STATS_BEGIN();
+    int64_t pos = scan_forward((uint64_t*) bv->arr, bv->allocated >> 3,
+                               from, ~0ULL);
+    BV_STATS_END(BV_OP_SCAN, ((pos < 0 ? bv->size : (elem_t) pos) - from) >> 3);
+    return (pos < 0 || (elem_t) pos >= bv->size) ? -1 : pos;
+}
+
+elem_t
+bv_popcount(struct bit_vector* bv)
+{
+    BV_STATS_BEGIN();
+    elem_t count = bv->allocated;
     uint8_t *arr = bv->arr;
-    for (int i = 0; i < count; i++) {
-        uint64_t cur = *(uint64_t*)(arr + (i << 3));
-        int lsb = ffsll(cur);
-        //LOG (INFO, "i=%d ffsll(%llu) = %d\n", i, cur, lsb);
-        if (unlikely(lsb)) return lsb-1 + (i << 6);
+#ifdef __AVX512VPOPCNTDQ__
+    __m512i acc = _mm512_setzero_si512();
+    for (elem_t i = 0; i < count; i += 64) {
+        __m512i v = _mm512_loadu_si512((void*) (arr+i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
     }
-    return -1;
+    elem_t n = _mm512_reduce_add_epi64(acc);
+#else
+    __m256i acc = _mm256_setzero_si256();
+    for (elem_t i = 0; i < count; i += 32) {
+        __m256i v = _mm256_load_si256((__m256i*) (arr+i));
+        acc = _mm256_add_epi64(acc, popcount_epi64_256(v));
+    }
+    elem_t n = hsum_epi64_256(acc);
+#endif
+    BV_STATS_END(BV_OP_POPCOUNT, count);
+    return n;
 }
 
 struct bit_vector*
@@ -122,8 +384,8 @@ bv_and(struct bit_vector* bv1, struct bit_vector* bv2)
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
     uint8_t *arr3 = bv3->arr;
-    int count = bv3->allocated;
-    for (int i = 0; i < count; i++) {
+    elem_t count = bv3->allocated;
+    for (elem_t i = 0; i < count; i++) {
         arr3[i] = arr1[i] & arr2[i];
     }
     return bv3;
@@ -139,8 +401,8 @@ bv_or(struct bit_vector* bv1, struct bit_vector* bv2)
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
     uint8_t *arr3 = bv3->arr;
-    int count = bv3->allocated;
-    for (int i = 0; i < count; i++) {
+    elem_t count = bv3->allocated;
+    for (elem_t i = 0; i < count; i++) {
         arr3[i] = arr1[i] | arr2[i];
     }
     return bv3;
@@ -156,8 +418,8 @@ bv_xor(struct bit_vector* bv1, struct bit_vector* bv2)
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
     uint8_t *arr3 = bv3->arr;
-    int count = bv3->allocated;
-    for (int i = 0; i < count; i++) {
+    elem_t count = bv3->allocated;
+    for (elem_t i = 0; i < count; i++) {
         arr3[i] = arr1[i] ^ arr2[i];
     }
     return bv3;
@@ -166,12 +428,12 @@ bv_xor(struct bit_vector* bv1, struct bit_vector* bv2)
 void
 bv_and_overwirte(struct bit_vector* bv1, struct bit_vector* bv2)
 {
-    int count = min(bv1->allocated, bv2->allocated);
+    elem_t count = min(bv1->allocated, bv2->allocated);
  
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
  
-    for (int i = 0; i < count; i++) {
+    for (elem_t i = 0; i < count; i++) {
         arr1[i] &= arr2[i];
     }
 }
@@ -179,12 +441,12 @@ bv_and_overwirte(struct bit_vector* bv1, struct bit_vector* bv2)
 void
 bv_or_overwirte(struct bit_vector* bv1, struct bit_vector* bv2)
 {
-    int count = min(bv1->allocated, bv2->allocated);
+    elem_t count = min(bv1->allocated, bv2->allocated);
  
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
  
-    for (int i = 0; i < count; i++) {
+    for (elem_t i = 0; i < count; i++) {
         arr1[i] |= arr2[i];
     }
 }
@@ -192,12 +454,12 @@ bv_or_overwirte(struct bit_vector* bv1, struct bit_vector* bv2)
 void
 bv_xor_overwirte(struct bit_vector* bv1, struct bit_vector* bv2)
 {
-    int count = min(bv1->allocated, bv2->allocated);
+    elem_t count = min(bv1->allocated, bv2->allocated);
  
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
  
-    for (int i = 0; i < count; i++) {
+    for (elem_t i = 0; i < count; i++) {
         arr1[i] ^= arr2[i];
     }
 }
@@ -206,39 +468,87 @@ void
 bv_and_with_dst(struct bit_vector* dst,
                 struct bit_vector* bv1, struct bit_vector* bv2)
 {
+    BV_STATS_BEGIN();
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
     uint8_t *arr3 = dst->arr;
-    int count = dst->allocated;
-    for (int i = 0; i < count; i++) {
+    elem_t count = dst->allocated;
+    if (unlikely(dst->allocated >= bv_stream_threshold())) {
+        bulk_stream(BULK_AND, arr3, arr1, arr2, dst->allocated);
+        BV_STATS_END(BV_OP_AND, 2 * dst->allocated);
+        return;
+    }
+    for (elem_t i = 0; i < count; i++) {
         arr3[i] = arr1[i] & arr2[i];
     }
+    BV_STATS_END(BV_OP_AND, 2 * dst->allocated);
 }
 
 void
 bv_or_with_dst(struct bit_vector* dst,
                struct bit_vector* bv1, struct bit_vector* bv2)
 {
+    BV_STATS_BEGIN();
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
     uint8_t *arr3 = dst->arr;
-    int count = dst->allocated;
-    for (int i = 0; i < count; i++) {
+    elem_t count = dst->allocated;
+    if (unlikely(dst->allocated >= bv_stream_threshold())) {
+        bulk_stream(BULK_OR, arr3, arr1, arr2, dst->allocated);
+        BV_STATS_END(BV_OP_OR, 2 * dst->allocated);
+        return;
+    }
+    for (elem_t i = 0; i < count; i++) {
         arr3[i] = arr1[i] | arr2[i];
     }
+    BV_STATS_END(BV_OP_OR, 2 * dst->allocated);
 }
 
 void
 bv_xor_with_dst(struct bit_vector* dst,
                 struct bit_vector* bv1, struct bit_vector* bv2)
 {
+    BV_STATS_BEGIN();
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
     uint8_t *arr3 = dst->arr;
-    int count = dst->allocated;
-    for (int i = 0; i < count; i++) {
+    elem_t count = dst->allocated;
+    if (unlikely(dst->allocated >= bv_stream_threshold())) {
+        bulk_stream(BULK_XOR, arr3, arr1, arr2, dst->allocated);
+        BV_STATS_END(BV_OP_XOR, 2 * dst->allocated);
+        return;
+    }
+    for (elem_t i = 0; i < count; i++) {
         arr3[i] = arr1[i] ^ arr2[i];
     }
+    BV_STATS_END(BV_OP_XOR, 2 * dst->allocated);
+}
+
+void
+bv_and_with_dst_stream(struct bit_vector* dst,
+                       struct bit_vector* bv1, struct bit_vector* bv2)
+{
+    BV_STATS_BEGIN();
+    bulk_stream(BULK_AND, dst->arr, bv1->arr, bv2->arr, dst->allocated);
+    BV_STATS_END(BV_OP_AND, 2 * dst->allocated);
+}
+
+void
+bv_or_with_dst_stream(struct bit_vector* dst,
+                      struct bit_vector* bv1, struct bit_vector* bv2)
+{
+    BV_STATS_BEGIN();
+    bulk_stream(BULK_OR, dst->arr, bv1->arr, bv2->arr, dst->allocated);
+    BV_STATS_END(BV_OP_OR, 2 * dst->allocated);
+}
+
+void
+bv_xor_with_dst_stream(struct bit_vector* dst,
+                       struct bit_vector* bv1, struct bit_vector* bv2)
+{
+    BV_STATS_BEGIN();
+    bulk_stream(BULK_XOR, dst->arr, bv1->arr, bv2->arr, dst->allocated);
+    BV_STATS_END(BV_OP_XOR, 2 * dst->allocated);
 }
 
 void
@@ -248,13 +558,20 @@ bv_and_with_dst_128(struct bit_vector* dst,
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
     uint8_t *arr3 = dst->arr;
-    int count = dst->allocated;
-    for (int i = 0; i < count; i+= 16) {
+    elem_t count = dst->allocated;
+    BV_STATS_BEGIN();
+    elem_t dist = bv_prefetch_distance(), pf_end = prefetch_end(count, dist);
+    for (elem_t i = 0; i < count; i+= 16) {
+        if (!(i & 63) && i < pf_end) {
+            rte_prefetch0(arr1+i+dist);
+            rte_prefetch0(arr2+i+dist);
+        }
         __m128i v1 = _mm_load_si128((__m128i*) (arr1+i));
         __m128i v2 = _mm_load_si128((__m128i*) (arr2+i));
         __m128i res = _mm_and_si128(v1, v2);
         _mm_store_si128((__m128i*)(arr3+i), res);
     }
+    BV_STATS_END(BV_OP_AND, 2 * dst->allocated);
 }
 
 void
@@ -264,27 +581,45 @@ bv_and_with_dst_256(struct bit_vector* dst,
     uint8_t *arr1 = bv1->arr;
     uint8_t *arr2 = bv2->arr;
     uint8_t *arr3 = dst->arr;
-    int count = dst->allocated;
-    for (int i = 0; i < count; i+= 32) {
+    elem_t count = dst->allocated;
+    BV_STATS_BEGIN();
+    if (unlikely(dst->allocated >= bv_stream_threshold())) {
+        bulk_stream(BULK_AND, arr3, arr1, arr2, dst->allocated);
+        BV_STATS_END(BV_OP_AND, 2 * dst->allocated);
+        return;
+    }
+    elem_t dist = bv_prefetch_distance(), pf_end = prefetch_end(count, dist);
+    for (elem_t i = 0; i < count; i+= 32) {
+        if (!(i & 63) && i < pf_end) {
+            rte_prefetch0(arr1+i+dist);
+            rte_prefetch0(arr2+i+dist);
+        }
         __m256i v1 = _mm256_load_si256((__m256i*) (arr1+i));
         __m256i v2 = _mm256_load_si256((__m256i*) (arr2+i));
         __m256i res = _mm256_and_si256((__m256i) v1, (__m256i)v2);
         _mm256_store_si256((__m256i*)(arr3+i), res);
     }
+    BV_STATS_END(BV_OP_AND, 2 * dst->allocated);
 }
 
 void
 bv_multiple_and_128(struct bit_vector* dst,
                     struct bit_vector** bvs, int bv_num)
 {
+    BV_STATS_BEGIN();
     uint8_t *arr = dst->arr;
     uint8_t *arrs[bv_num];
     for (int i = 0; i < bv_num; ++i) {
         arrs[i] = bvs[i]->arr;
     }
 
-    int count = dst->allocated;
-    for (int i = 0; i < count; i+= 16) {
+    elem_t count = dst->allocated;
+    elem_t dist = bv_prefetch_distance(), pf_end = prefetch_end(count, dist);
+    for (elem_t i = 0; i < count; i+= 16) {
+        if (!(i & 63) && i < pf_end) {
+            for (int j = 0; j < bv_num; ++j)
+                rte_prefetch0(arrs[j]+i+dist);
+        }
         __m128i res = _mm_load_si128((__m128i*) (arrs[0]+i));
         for (int j = 0; j < bv_num; ++j) {
             __m128i vec = _mm_load_si128((__m128i*) (arrs[j]+i));
@@ -292,38 +627,251 @@ bv_multiple_and_128(struct bit_vector* dst,
         }
         _mm_store_si128((__m128i*)(arr+i), res);
     }
+    BV_STATS_END(BV_OP_MULTIPLE_AND, (elem_t) bv_num * dst->allocated);
+}
 
+/**
+ * Multi-AND body shared by the cached and streaming variants.  dist is
+ * passed in rather than read from prefetch_distance so that calibration
+ * can time candidates without touching the live setting.
+ */
+static inline void
+multiple_and_kernel(uint8_t* arr, uint8_t** arrs, int bv_num,
+                    elem_t count, elem_t dist, bool stream)
+{
+    elem_t pf_end = prefetch_end(count, dist);
+    for (elem_t i = 0; i < count; i+= 64) {
+        if (i < pf_end) {
+            for (int j = 0; j < bv_num; ++j)
+                rte_prefetch0(arrs[j]+i+dist);
+        }
+        __m256i res0 = _mm256_load_si256((__m256i*) (arrs[0]+i));
+        __m256i res1 = _mm256_load_si256((__m256i*) (arrs[0]+i+32));
+        for (int j = 1; j < bv_num; ++j) {
+            __m256i vec0 = _mm256_load_si256((__m256i*) (arrs[j]+i));
+            __m256i vec1 = _mm256_load_si256((__m256i*) (arrs[j]+i+32));
+            res0 = _mm256_and_si256(res0, vec0);
+            res1 = _mm256_and_si256(res1, vec1);
+        }
+        if (stream) {
+            _mm256_stream_si256((__m256i*)(arr+i), res0);
+            _mm256_stream_si256((__m256i*)(arr+i+32), res1);
+        } else {
+            _mm256_store_si256((__m256i*)(arr+i), res0);
+            _mm256_store_si256((__m256i*)(arr+i+32), res1);
+        }
+    }
+    if (stream) _mm_sfence();
 }
 
 void
 bv_multiple_and_256(struct bit_vector* dst,
                     struct bit_vector** bvs, int bv_num)
 {
+    if (unlikely(dst->allocated >= bv_stream_threshold())) {
+        bv_multiple_and_stream(dst, bvs, bv_num);
+        return;
+    }
+
+    BV_STATS_BEGIN();
     uint8_t *arrs[bv_num];
     for (int i = 0; i < bv_num; ++i) {
         arrs[i] = bvs[i]->arr;
     }
+    multiple_and_kernel(dst->arr, arrs, bv_num, dst->allocated,
+                        bv_prefetch_distance(), false);
+    BV_STATS_END(BV_OP_MULTIPLE_AND, (elem_t) bv_num * dst->allocated);
+}
 
-    int count = dst->allocated;
-    uint8_t *arr = dst->arr;
-    for (int i = 0; i < count; i+= 32) {
-        __m256i res = _mm256_load_si256((__m256i*) (arrs[0]+i));
-        for (int j = 0; j < bv_num; ++j) {
-            __m256i vec = _mm256_load_si256((__m256i*) (arrs[j]+i));
-            res = _mm256_and_si256((__m256i) res, (__m256i)vec);
+void
+bv_multiple_and_stream(struct bit_vector* dst,
+                       struct bit_vector** bvs, int bv_num)
+{
+    BV_STATS_BEGIN();
+    uint8_t *arrs[bv_num];
+    for (int i = 0; i < bv_num; ++i) {
+        arrs[i] = bvs[i]->arr;
+    }
+    multiple_and_kernel(dst->arr, arrs, bv_num, dst->allocated,
+                        bv_prefetch_distance(), true);
+    BV_STATS_END(BV_OP_MULTIPLE_AND, (elem_t) bv_num * dst->allocated);
+}
+
+/**
+ * ANDs the 64-byte block at offset i of every operand into res.  Stops
+ * reading operands as soon as the partial result is empty and returns
+ * false in that case.
+ */
+static inline bool
+and_block_64(uint64_t res[8], uint8_t** arrs, int bv_num, elem_t i)
+{
+    __m256i r0 = _mm256_load_si256((__m256i*) (arrs[0]+i));
+    __m256i r1 = _mm256_load_si256((__m256i*) (arrs[0]+i+32));
+    for (int j = 1; j < bv_num; ++j) {
+        __m256i o = _mm256_or_si256(r0, r1);
+        if (_mm256_testz_si256(o, o)) return false;
+        r0 = _mm256_and_si256(r0, _mm256_load_si256((__m256i*) (arrs[j]+i)));
+        r1 = _mm256_and_si256(r1, _mm256_load_si256((__m256i*) (arrs[j]+i+32)));
+    }
+    __m256i o = _mm256_or_si256(r0, r1);
+    if (_mm256_testz_si256(o, o)) return false;
+    _mm256_storeu_si256((__m256i*) res, r0);
+    _mm256_storeu_si256((__m256i*) (res+4), r1);
+    return true;
+}
+
+static inline elem_t
+min_size(struct bit_vector** bvs, int bv_num)
+{
+    elem_t size = bvs[0]->size;
+    for (int i = 1; i < bv_num; ++i)
+        size = min(size, bvs[i]->size);
+    return size;
+}
+
+int
+bv_multiple_and_topk(struct bit_vector** bvs, int bv_num, int k, elem_t* out)
+{
+    elem_t size = min_size(bvs, bv_num);
+    uint8_t *arrs[bv_num];
+    for (int i = 0; i < bv_num; ++i) {
+        arrs[i] = bvs[i]->arr;
+    }
+
+    BV_STATS_BEGIN();
+    int found = 0;
+    elem_t count = ROUNDUP512(size) >> 3;
+    elem_t dist = bv_prefetch_distance(), pf_end = prefetch_end(count, dist);
+    elem_t i = 0;
+    for (; i < count && found < k; i += 64) {
+        if (i < pf_end) {
+            for (int j = 0; j < bv_num; ++j)
+                rte_prefetch0(arrs[j]+i+dist);
+        }
+        uint64_t res[8];
+        if (likely(!and_block_64(res, arrs, bv_num, i))) continue;
+        for (int w = 0; w < 8; ++w) {
+            uint64_t cur = res[w];
+            while (cur) {
+                elem_t pos = ((i + (w << 3)) << 3) + __builtin_ctzll(cur);
+                if (pos >= size || found == k) goto out;
+                out[found++] = pos;
+                cur &= cur - 1;
+            }
+        }
+    }
+out:
+    BV_STATS_END(BV_OP_TOPK, (elem_t) bv_num * (i < count ? i + 64 : count));
+    return found;
+}
+
+int
+bv_multiple_and_topk_reverse(struct bit_vector** bvs, int bv_num, int k,
+                             elem_t* out)
+{
+    elem_t size = min_size(bvs, bv_num);
+    uint8_t *arrs[bv_num];
+    for (int i = 0; i < bv_num; ++i) {
+        arrs[i] = bvs[i]->arr;
+    }
+
+    BV_STATS_BEGIN();
+    int found = 0;
+    elem_t count = ROUNDUP512(size) >> 3;
+    elem_t dist = bv_prefetch_distance();
+    elem_t i = count;
+    while (i > 0 && found < k) {
+        i -= 64;
+        if (dist && i >= dist) {
+            for (int j = 0; j < bv_num; ++j)
+                rte_prefetch0(arrs[j]+i-dist);
+        }
+        uint64_t res[8];
+        if (likely(!and_block_64(res, arrs, bv_num, i))) continue;
+        for (int w = 7; w >= 0; --w) {
+            elem_t base = (i + (w << 3)) << 3;
+            uint64_t cur = res[w];
+            // drop the padding above size in the last block
+            if (base + 64 > size)
+                cur = base >= size ? 0 : cur & (~0ULL >> (64 - (size - base)));
+            while (cur) {
+                int msb = 63 - __builtin_clzll(cur);
+                if (found == k) goto out;
+                out[found++] = base + msb;
+                cur &= ~(1ULL << msb);
+            }
+        }
+    }
+out:
+    BV_STATS_END(BV_OP_TOPK, (elem_t) bv_num * (count - i));
+    return found;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+elem_t
+bv_calibrate_prefetch(elem_t bit_size, int bv_num)
+{
+    static const elem_t candidates[] = { 0, 128, 256, 512, 1024, 2048, 4096 };
+    int ncand = sizeof(candidates) / sizeof(candidates[0]);
+    elem_t best = bv_prefetch_distance();
+    double best_time = 0;
+
+    struct bit_vector* dst = bv_create(bit_size);
+    struct bit_vector* bvs[bv_num];
+    uint8_t *arrs[bv_num];
+    memset(bvs, 0, sizeof(bvs));
+    if (dst == NULL) goto out;
+    for (int i = 0; i < bv_num; ++i) {
+        bvs[i] = bv_create(bit_size);
+        if (bvs[i] == NULL) goto out;
+        memset(bvs[i]->arr, 0xff, bvs[i]->allocated);
+        arrs[i] = bvs[i]->arr;
+    }
+    bool stream = dst->allocated >= bv_stream_threshold();
+
+    for (int c = 0; c < ncand; ++c) {
+        double elapsed = 0;
+        for (int r = 0; r < 3; ++r) {
+            // time the cold case: operands come from DRAM
+            for (int i = 0; i < bv_num; ++i)
+                for (elem_t k = 0; k < bvs[i]->allocated; k += 64)
+                    _mm_clflush(bvs[i]->arr + k);
+            _mm_mfence();
+            double start = now();
+            multiple_and_kernel(dst->arr, arrs, bv_num, dst->allocated,
+                                candidates[c], stream);
+            double t = now() - start;
+            if (r == 0 || t < elapsed) elapsed = t;
+        }
+        if (c == 0 || elapsed < best_time) {
+            best_time = elapsed;
+            best = candidates[c];
         }
-        _mm256_store_si256((__m256i*)(arr+i), res);
     }
+    // publish once: concurrent kernels never see a trial distance
+    bv_set_prefetch_distance(best);
+
+out:
+    for (int i = 0; i < bv_num; ++i)
+        if (bvs[i]) bv_destroy(bvs[i]);
+    if (dst) bv_destroy(dst);
+    return best;
 }
 
-             
 void
 bv_print(struct bit_vector* bv)
 {
     LOG(INFO, "bit_vector: %p size : %lu\n"
         "arr       : %p\n", bv, bv->size, bv->arr);
-    int size = (bv->size >> 3) - 1 + ((bv->size & 7U) ? 1 : 0);
-    for (int i = size; i >= 0; --i) {
+    int64_t size = (bv->size >> 3) - 1 + ((bv->size & 7U) ? 1 : 0);
+    for (int64_t i = size; i >= 0; --i) {
         uint8_t val = bv->arr[i];
         for (int j = 7; j >= 0; --j) 
             printf("%u", val >> j & 1);
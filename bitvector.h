@@ -10,6 +10,10 @@
 #include <stdbool.h>
 #include "prefetch.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef size_t elem_t;
 
 struct bit_vector {
@@ -18,13 +22,40 @@ struct bit_vector {
     // available bit length
     elem_t size; 
     
-    // bit vector body
-    uint8_t arr[0] __attribute__((aligned(32)));
+    // bit vector body, starts on a cache line
+    uint8_t arr[0] __attribute__((aligned(64)));
 };
 
+/**
+ * Default distance (bytes) the bulk kernels prefetch ahead on every
+ * operand; tune at run time with bv_set_prefetch_distance() or
+ * bv_calibrate_prefetch().  0 disables software prefetch.
+ */
+#ifndef BV_PREFETCH_DISTANCE
+#define BV_PREFETCH_DISTANCE 512
+#endif
+
 void
 bv_prefetch(struct bit_vector* bv);
 
+// warms the cache lines holding bits [from, from + len)
+void
+bv_prefetch_range(struct bit_vector* bv, elem_t from, elem_t len);
+
+elem_t
+bv_prefetch_distance(void);
+
+void
+bv_set_prefetch_distance(elem_t bytes);
+
+/**
+ * Times bv_multiple_and_256() over bv_num cold vectors of bit_size bits
+ * for a range of distances, keeps the fastest and returns it.  Size the
+ * workload like the real queries.
+ */
+elem_t
+bv_calibrate_prefetch(elem_t bit_size, int bv_num);
+
 struct bit_vector*
 bv_create(elem_t bit_size);
 
@@ -43,10 +74,32 @@ bv_value(struct bit_vector* bv,elem_t index);
 struct bit_vector*
 bv_not(struct bit_vector* bv1);
 
+void
+bv_not_with_dst(struct bit_vector* dst, struct bit_vector* bv);
+
 // if all bit is 0, return -1
-int
+int64_t
 bv_ffs(struct bit_vector* bv);
 
+// first set bit at or after from, -1 if none
+int64_t
+bv_find_next(struct bit_vector* bv, elem_t from);
+
+// last set bit, -1 if none
+int64_t
+bv_fls(struct bit_vector* bv);
+
+// first clear bit below size, -1 if none
+int64_t
+bv_ffz(struct bit_vector* bv);
+
+// first clear bit at or after from and below size, -1 if none
+int64_t
+bv_find_next_zero(struct bit_vector* bv, elem_t from);
+
+elem_t
+bv_popcount(struct bit_vector* bv);
+
 struct bit_vector*
 bv_and(struct bit_vector* bv1, struct bit_vector* bv2);
 
@@ -77,6 +130,24 @@ void
 bv_xor_with_dst(struct bit_vector* dst,
                 struct bit_vector* bv1, struct bit_vector* bv2);
 
+/**
+ * Same as the _with_dst family but dst is written with non-temporal
+ * stores (movntdq) followed by an sfence, bypassing the cache.  The
+ * regular entry points switch to these automatically once dst->allocated
+ * reaches bv_stream_threshold().
+ */
+void
+bv_and_with_dst_stream(struct bit_vector* dst,
+                       struct bit_vector* bv1, struct bit_vector* bv2);
+
+void
+bv_or_with_dst_stream(struct bit_vector* dst,
+                      struct bit_vector* bv1, struct bit_vector* bv2);
+
+void
+bv_xor_with_dst_stream(struct bit_vector* dst,
+                       struct bit_vector* bv1, struct bit_vector* bv2);
+
 void
 bv_and_with_dst_128(struct bit_vector* dst,
                 struct bit_vector* bv1, struct bit_vector* bv2);
@@ -97,5 +168,34 @@ void
 bv_multiple_and_256(struct bit_vector* dst,
                     struct bit_vector** bvs, int bv_num);
 
+/**
+ * Writes the lowest (highest for _reverse) k positions of the
+ * intersection of bvs to out, in scan order, and returns how many were
+ * found.  Works a 512-bit block at a time and stops reading once k
+ * positions are collected, so the cost depends on where the k-th match
+ * is rather than on the vector length.
+ */
+int
+bv_multiple_and_topk(struct bit_vector** bvs, int bv_num, int k, elem_t* out);
+
+int
+bv_multiple_and_topk_reverse(struct bit_vector** bvs, int bv_num, int k,
+                             elem_t* out);
+
+void
+bv_multiple_and_stream(struct bit_vector* dst,
+                       struct bit_vector** bvs, int bv_num);
+
+// defaults to half of the detected LLC size
+size_t
+bv_stream_threshold(void);
+
+// 0 re-detects, SIZE_MAX disables streaming
+void
+bv_set_stream_threshold(size_t bytes);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
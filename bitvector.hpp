@@ -0,0 +1,399 @@
+/**
+ *  bitvector.hpp
+ *
+ *  Compile-time sized bit vector for C++ callers.
+ *
+ *  bv::bitvector<N> keeps its words inline (no malloc) and every bulk
+ *  operation is expanded over an index_sequence, so for N up to
+ *  unroll_limit_bits the kernels are straight-line code and 256/512-bit
+ *  vectors stay in a single ymm/zmm register.  Larger N falls back to a
+ *  plain loop; use load()/store()/to_c() to exchange data with the C API.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef BITVECTOR_HPP
+#define BITVECTOR_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <immintrin.h>
+
+#include "bitvector.h"
+
+namespace bv {
+
+// kernels above this size are emitted as loops instead of unrolled code
+constexpr std::size_t unroll_limit_bits = 4096;
+
+namespace detail {
+
+constexpr std::size_t
+word_count(std::size_t bits)
+{
+    // vectors wider than 128 bits are padded to whole ymm registers
+    return bits <= 64 ? 1 :
+           bits <= 128 ? 2 : ((bits + 255) / 256) * 4;
+}
+
+constexpr std::size_t
+word_align(std::size_t words)
+{
+    return words >= 8 ? 64 : words >= 4 ? 32 : 8;
+}
+
+constexpr uint64_t
+tail_mask(std::size_t bits)
+{
+    return (bits & 63) ? ((1ULL << (bits & 63)) - 1) : ~0ULL;
+}
+
+/**
+ * Block-wise primitives.  Plain words are always available, the SIMD
+ * blocks are picked when the ISA is enabled and the word count is a
+ * multiple of the register width.
+ */
+struct word_block {};
+struct ymm_block {};
+struct zmm_block {};
+
+template <class Tag>
+struct block_ops;
+
+template <>
+struct block_ops<word_block> {
+    typedef uint64_t block;
+    static constexpr std::size_t words = 1;
+    static block load(const uint64_t* p) { return *p; }
+    static void store(uint64_t* p, block v) { *p = v; }
+    static block and_(block a, block b) { return a & b; }
+    static block or_(block a, block b) { return a | b; }
+    static block xor_(block a, block b) { return a ^ b; }
+    static block andnot(block a, block b) { return a & ~b; }
+};
+
+#ifdef __AVX2__
+template <>
+struct block_ops<ymm_block> {
+    typedef __m256i block;
+    static constexpr std::size_t words = 4;
+    static block load(const uint64_t* p)
+    { return _mm256_load_si256((const __m256i*) p); }
+    static void store(uint64_t* p, block v)
+    { _mm256_store_si256((__m256i*) p, v); }
+    static block and_(block a, block b) { return _mm256_and_si256(a, b); }
+    static block or_(block a, block b) { return _mm256_or_si256(a, b); }
+    static block xor_(block a, block b) { return _mm256_xor_si256(a, b); }
+    static block andnot(block a, block b) { return _mm256_andnot_si256(b, a); }
+};
+#endif
+
+#ifdef __AVX512F__
+template <>
+struct block_ops<zmm_block> {
+    typedef __m512i block;
+    static constexpr std::size_t words = 8;
+    static block load(const uint64_t* p)
+    { return _mm512_load_si512((const void*) p); }
+    static void store(uint64_t* p, block v)
+    { _mm512_store_si512((void*) p, v); }
+    static block and_(block a, block b) { return _mm512_and_si512(a, b); }
+    static block or_(block a, block b) { return _mm512_or_si512(a, b); }
+    static block xor_(block a, block b) { return _mm512_xor_si512(a, b); }
+    static block andnot(block a, block b) { return _mm512_andnot_si512(b, a); }
+};
+#endif
+
+template <std::size_t W>
+struct block_select {
+#if defined(__AVX512F__)
+    typedef typename std::conditional<W % 8 == 0, zmm_block,
+            typename std::conditional<W % 4 == 0, ymm_block,
+                                      word_block>::type>::type type;
+#elif defined(__AVX2__)
+    typedef typename std::conditional<W % 4 == 0, ymm_block,
+                                      word_block>::type type;
+#else
+    typedef word_block type;
+#endif
+};
+
+struct op_and {
+    template <class O> static typename O::block
+    apply(typename O::block a, typename O::block b) { return O::and_(a, b); }
+};
+struct op_or {
+    template <class O> static typename O::block
+    apply(typename O::block a, typename O::block b) { return O::or_(a, b); }
+};
+struct op_xor {
+    template <class O> static typename O::block
+    apply(typename O::block a, typename O::block b) { return O::xor_(a, b); }
+};
+struct op_andnot {
+    template <class O> static typename O::block
+    apply(typename O::block a, typename O::block b) { return O::andnot(a, b); }
+};
+
+template <std::size_t W, bool Unroll = (W * 64 <= unroll_limit_bits)>
+struct kernels {
+    typedef block_ops<typename block_select<W>::type> ops;
+    static constexpr std::size_t blocks = W / ops::words;
+    typedef std::make_index_sequence<blocks> block_seq;
+    typedef std::make_index_sequence<W> word_seq;
+
+    template <class Op, std::size_t... I>
+    static void
+    binary(uint64_t* d, const uint64_t* a, const uint64_t* b,
+           std::index_sequence<I...>)
+    {
+        ((ops::store(d + I * ops::words,
+                     Op::template apply<ops>(ops::load(a + I * ops::words),
+                                             ops::load(b + I * ops::words)))),
+         ...);
+    }
+
+    template <class Op>
+    static void
+    binary(uint64_t* d, const uint64_t* a, const uint64_t* b)
+    { binary<Op>(d, a, b, block_seq()); }
+
+    template <std::size_t... I>
+    static int64_t
+    ffs(const uint64_t* w, std::index_sequence<I...>)
+    {
+        int64_t r = -1;
+        (void) ((w[I] ? (r = I * 64 + __builtin_ctzll(w[I]), true) : false)
+                || ...);
+        return r;
+    }
+
+    static int64_t
+    ffs(const uint64_t* w) { return ffs(w, word_seq()); }
+
+    template <std::size_t... I>
+    static std::size_t
+    popcount(const uint64_t* w, std::index_sequence<I...>)
+    { return (std::size_t(0) + ... + (std::size_t) __builtin_popcountll(w[I])); }
+
+    static std::size_t
+    popcount(const uint64_t* w) { return popcount(w, word_seq()); }
+
+    template <std::size_t... I>
+    static bool
+    none(const uint64_t* w, std::index_sequence<I...>)
+    { return (uint64_t(0) | ... | w[I]) == 0; }
+
+    static bool
+    none(const uint64_t* w) { return none(w, word_seq()); }
+};
+
+template <std::size_t W>
+struct kernels<W, false> {
+    typedef block_ops<typename block_select<W>::type> ops;
+
+    template <class Op>
+    static void
+    binary(uint64_t* d, const uint64_t* a, const uint64_t* b)
+    {
+        for (std::size_t i = 0; i < W; i += ops::words)
+            ops::store(d + i, Op::template apply<ops>(ops::load(a + i),
+                                                      ops::load(b + i)));
+    }
+
+    static int64_t
+    ffs(const uint64_t* w)
+    {
+        for (std::size_t i = 0; i < W; ++i)
+            if (w[i]) return (int64_t) (i * 64 + __builtin_ctzll(w[i]));
+        return -1;
+    }
+
+    static std::size_t
+    popcount(const uint64_t* w)
+    {
+        std::size_t c = 0;
+        for (std::size_t i = 0; i < W; ++i) c += __builtin_popcountll(w[i]);
+        return c;
+    }
+
+    static bool
+    none(const uint64_t* w)
+    {
+        uint64_t acc = 0;
+        for (std::size_t i = 0; i < W; ++i) acc |= w[i];
+        return acc == 0;
+    }
+};
+
+} // namespace detail
+
+template <std::size_t N>
+class bitvector {
+    static_assert(N > 0, "bitvector<0> is not allowed");
+
+public:
+    static constexpr std::size_t bits = N;
+    static constexpr std::size_t words = detail::word_count(N);
+    static constexpr std::size_t bytes = words * sizeof(uint64_t);
+
+private:
+    typedef detail::kernels<words> kern;
+    static constexpr std::size_t last = (N - 1) / 64;
+
+    alignas(detail::word_align(words)) uint64_t w_[words];
+
+public:
+    constexpr bitvector() : w_{} {}
+
+    // copies the first min(N, bv->size) bits of a C vector
+    explicit bitvector(const struct bit_vector* bv) : w_{} { load(bv); }
+
+    uint64_t* data() { return w_; }
+    const uint64_t* data() const { return w_; }
+    static constexpr std::size_t size() { return N; }
+
+    bool
+    test(std::size_t i) const
+    {
+        assert(i < N);
+        return (w_[i >> 6] >> (i & 63)) & 1;
+    }
+
+    void
+    set(std::size_t i, bool val = true)
+    {
+        assert(i < N);
+        uint64_t m = 1ULL << (i & 63);
+        w_[i >> 6] = (w_[i >> 6] & ~m) | (val ? m : 0);
+    }
+
+    void reset(std::size_t i) { set(i, false); }
+    void clear() { std::memset(w_, 0, sizeof(w_)); }
+
+    // if all bit is 0, return -1
+    int64_t ffs() const { return kern::ffs(w_); }
+    std::size_t popcount() const { return kern::popcount(w_); }
+    bool none() const { return kern::none(w_); }
+    bool any() const { return !none(); }
+
+    bitvector&
+    operator&=(const bitvector& o)
+    { kern::template binary<detail::op_and>(w_, w_, o.w_); return *this; }
+
+    bitvector&
+    operator|=(const bitvector& o)
+    { kern::template binary<detail::op_or>(w_, w_, o.w_); return *this; }
+
+    bitvector&
+    operator^=(const bitvector& o)
+    { kern::template binary<detail::op_xor>(w_, w_, o.w_); return *this; }
+
+    // this &= ~o
+    bitvector&
+    andnot(const bitvector& o)
+    { kern::template binary<detail::op_andnot>(w_, w_, o.w_); return *this; }
+
+    friend bitvector
+    operator&(const bitvector& a, const bitvector& b)
+    {
+        bitvector r;
+        kern::template binary<detail::op_and>(r.w_, a.w_, b.w_);
+        return r;
+    }
+
+    friend bitvector
+    operator|(const bitvector& a, const bitvector& b)
+    {
+        bitvector r;
+        kern::template binary<detail::op_or>(r.w_, a.w_, b.w_);
+        return r;
+    }
+
+    friend bitvector
+    operator^(const bitvector& a, const bitvector& b)
+    {
+        bitvector r;
+        kern::template binary<detail::op_xor>(r.w_, a.w_, b.w_);
+        return r;
+    }
+
+    friend bitvector
+    operator~(const bitvector& a)
+    {
+        static const bitvector ones = all_ones();
+        bitvector r;
+        kern::template binary<detail::op_andnot>(r.w_, ones.w_, a.w_);
+        return r;
+    }
+
+    friend bool
+    operator==(const bitvector& a, const bitvector& b)
+    { return std::memcmp(a.w_, b.w_, sizeof(a.w_)) == 0; }
+
+    friend bool
+    operator!=(const bitvector& a, const bitvector& b) { return !(a == b); }
+
+    /**
+     * C API interop.  The byte layout of arr[] is identical to the
+     * little-endian word layout used here, so conversion is a memcpy.
+     */
+    void
+    load(const struct bit_vector* bv)
+    {
+        std::size_t n = bv->size < N ? bv->size : N;
+        clear();
+        std::memcpy(w_, bv->arr, (n + 7) >> 3);
+        if (n & 63)
+            w_[(n - 1) >> 6] &= detail::tail_mask(n);
+    }
+
+    // dst must hold at least N bits; bits of dst beyond N are untouched
+    void
+    store(struct bit_vector* dst) const
+    {
+        assert(dst->size >= N);
+        std::memcpy(dst->arr, w_, (N + 7) >> 3);
+        if (N & 7) {
+            uint8_t keep = (uint8_t) ~((1U << (N & 7)) - 1);
+            uint8_t* p = dst->arr + (N >> 3);
+            *p = (*p & keep) | (((const uint8_t*) w_)[N >> 3] & ~keep);
+        }
+    }
+
+    // returns a freshly bv_create()d copy; release it with bv_destroy()
+    struct bit_vector*
+    to_c() const
+    {
+        struct bit_vector* bv = bv_create(N);
+        if (bv != NULL) store(bv);
+        return bv;
+    }
+
+private:
+    static bitvector
+    all_ones()
+    {
+        bitvector r;
+        for (std::size_t i = 0; i < last; ++i) r.w_[i] = ~0ULL;
+        r.w_[last] = detail::tail_mask(N);
+        return r;
+    }
+};
+
+// dst = bvs[0] & bvs[1] & ... & bvs[n-1], the bv_multiple_and() counterpart
+template <std::size_t N>
+inline void
+multiple_and(bitvector<N>& dst, const bitvector<N>* const* bvs, std::size_t n)
+{
+    assert(n > 0);
+    dst = *bvs[0];
+    for (std::size_t i = 1; i < n; ++i) dst &= *bvs[i];
+}
+
+} // namespace bv
+
+#endif
@@ -0,0 +1,224 @@
+/**
+ *  bloom_filter.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "prefetch.h"
+#include "bloom_filter.h"
+
+// keys prefetched ahead in the batched paths
+#define BLOOM_PREFETCH_AHEAD 8
+
+// odd multipliers, one per lane (same scheme as split block filters)
+static const uint32_t salts[BLOOM_MAX_K] __attribute__((aligned(32))) = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+    0x2a9d7b63U, 0x6ca5a3e7U, 0x3b8f1d2dU, 0xe4c6b2a9U,
+    0x1f2e3d4bU, 0x9d8c7b6fU, 0x7a5b3c1dU, 0xc3a5e1f7U,
+};
+
+static inline uint64_t
+mix64(uint64_t x)
+{
+    // murmur3 finalizer
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static inline uint8_t*
+block_of(struct bloom_filter* bf, uint64_t h)
+{
+    // map the high half onto [0, blocks) without a division
+    elem_t idx = (elem_t) (((unsigned __int128) h * bf->blocks) >> 64);
+    return bf->bv->arr + (idx << 6);
+}
+
+/**
+ * Lane i of the two halves gets bit (x * salt[i]) >> 27.  Lanes >= k are
+ * cleared so k can be anything from 1 to 16.
+ */
+static inline void
+key_masks(struct bloom_filter* bf, uint64_t h, __m256i* m0, __m256i* m1)
+{
+    __m256i x = _mm256_set1_epi32((uint32_t) h);
+    __m256i ones = _mm256_set1_epi32(1);
+    __m256i s0 = _mm256_load_si256((const __m256i*) salts);
+    __m256i s1 = _mm256_load_si256((const __m256i*) (salts + 8));
+    __m256i b0 = _mm256_srli_epi32(_mm256_mullo_epi32(x, s0), 27);
+    __m256i b1 = _mm256_srli_epi32(_mm256_mullo_epi32(x, s1), 27);
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i k = _mm256_set1_epi32(bf->k);
+    __m256i en0 = _mm256_cmpgt_epi32(k, lane);
+    __m256i en1 = _mm256_cmpgt_epi32(k, _mm256_add_epi32(lane, _mm256_set1_epi32(8)));
+    *m0 = _mm256_and_si256(_mm256_sllv_epi32(ones, b0), en0);
+    *m1 = _mm256_and_si256(_mm256_sllv_epi32(ones, b1), en1);
+}
+
+static inline void
+insert_hash(struct bloom_filter* bf, uint64_t h)
+{
+    __m256i m0, m1;
+    key_masks(bf, h, &m0, &m1);
+    uint8_t* blk = block_of(bf, h);
+    __m256i v0 = _mm256_load_si256((__m256i*) blk);
+    __m256i v1 = _mm256_load_si256((__m256i*) (blk + 32));
+    _mm256_store_si256((__m256i*) blk, _mm256_or_si256(v0, m0));
+    _mm256_store_si256((__m256i*) (blk + 32), _mm256_or_si256(v1, m1));
+}
+
+static inline bool
+query_hash(struct bloom_filter* bf, uint64_t h)
+{
+    __m256i m0, m1;
+    key_masks(bf, h, &m0, &m1);
+    uint8_t* blk = block_of(bf, h);
+    __m256i v0 = _mm256_load_si256((__m256i*) blk);
+    __m256i v1 = _mm256_load_si256((__m256i*) (blk + 32));
+    // testc: every bit of the mask is set in the block
+    return _mm256_testc_si256(v0, m0) & _mm256_testc_si256(v1, m1);
+}
+
+struct bloom_filter*
+bloom_create(elem_t bit_size, int k)
+{
+    assert(k >= 1 && k <= BLOOM_MAX_K);
+    struct bloom_filter* bf = (struct bloom_filter*) malloc(sizeof(*bf));
+    if (bf == NULL) return NULL;
+
+    bit_size = max(ROUNDUP512(bit_size), (elem_t) BLOOM_BLOCK_BITS);
+    bf->bv = bv_create(bit_size);
+    if (bf->bv == NULL) {
+        free(bf);
+        return NULL;
+    }
+    bf->blocks = bit_size / BLOOM_BLOCK_BITS;
+    bf->k = k;
+    return bf;
+}
+
+void
+bloom_destroy(struct bloom_filter* bf)
+{
+    bv_destroy(bf->bv);
+    free(bf);
+}
+
+void
+bloom_insert(struct bloom_filter* bf, uint64_t key)
+{
+    insert_hash(bf, mix64(key));
+}
+
+bool
+bloom_query(struct bloom_filter* bf, uint64_t key)
+{
+    return query_hash(bf, mix64(key));
+}
+
+void
+bloom_insert_batch(struct bloom_filter* bf, const uint64_t* keys, elem_t n)
+{
+    uint64_t ring[BLOOM_PREFETCH_AHEAD];
+    elem_t ahead = min(n, (elem_t) BLOOM_PREFETCH_AHEAD);
+    for (elem_t i = 0; i < ahead; ++i) {
+        ring[i] = mix64(keys[i]);
+        rte_prefetch0(block_of(bf, ring[i]));
+    }
+    for (elem_t i = 0; i < n; ++i) {
+        uint64_t h = ring[i % BLOOM_PREFETCH_AHEAD];
+        if (i + BLOOM_PREFETCH_AHEAD < n) {
+            uint64_t next = mix64(keys[i + BLOOM_PREFETCH_AHEAD]);
+            ring[i % BLOOM_PREFETCH_AHEAD] = next;
+            rte_prefetch0(block_of(bf, next));
+        }
+        insert_hash(bf, h);
+    }
+}
+
+elem_t
+bloom_query_batch(struct bloom_filter* bf, const uint64_t* keys, elem_t n,
+                  bool* out)
+{
+    uint64_t ring[BLOOM_PREFETCH_AHEAD];
+    elem_t hits = 0;
+    elem_t ahead = min(n, (elem_t) BLOOM_PREFETCH_AHEAD);
+    for (elem_t i = 0; i < ahead; ++i) {
+        ring[i] = mix64(keys[i]);
+        rte_prefetch0(block_of(bf, ring[i]));
+    }
+    for (elem_t i = 0; i < n; ++i) {
+        uint64_t h = ring[i % BLOOM_PREFETCH_AHEAD];
+        if (i + BLOOM_PREFETCH_AHEAD < n) {
+            uint64_t next = mix64(keys[i + BLOOM_PREFETCH_AHEAD]);
+            ring[i % BLOOM_PREFETCH_AHEAD] = next;
+            rte_prefetch0(block_of(bf, next));
+        }
+        bool hit = query_hash(bf, h);
+        out[i] = hit;
+        hits += hit;
+    }
+    return hits;
+}
+
+/**
+ * The number of keys per block is ~Poisson(n / blocks).  A block holding
+ * j keys answers a false positive with probability
+ * (1 - (1 - 1/32)^j)^k since every key sets one bit per used lane.
+ */
+double
+bloom_fpr(elem_t bit_size, int k, elem_t n)
+{
+    double blocks = (double) (ROUNDUP512(bit_size) / BLOOM_BLOCK_BITS);
+    double lambda = (double) n / blocks;
+    double term = exp(-lambda), res = 0;
+    int end = (int) (lambda + 10 * sqrt(lambda) + 10);
+    for (int j = 0; j <= end; ++j) {
+        if (j > 0) term *= lambda / j;
+        res += term * pow(1.0 - pow(1.0 - 1.0 / 32, j), k);
+    }
+    return res;
+}
+
+bool
+bloom_size_for(elem_t n, double fpr, elem_t* bit_size, int* k)
+{
+    if (n == 0) n = 1;
+    // bits per key from 1 to 64, in whole blocks
+    for (elem_t bits = ROUNDUP512(n); bits <= ROUNDUP512(n * 64);
+         bits += max(ROUNDUP512(n / 16), (elem_t) BLOOM_BLOCK_BITS)) {
+        for (int kk = 1; kk <= BLOOM_MAX_K; ++kk) {
+            if (bloom_fpr(bits, kk, n) <= fpr) {
+                *bit_size = bits;
+                *k = kk;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+struct bloom_filter*
+bloom_create_for(elem_t n, double fpr)
+{
+    elem_t bits;
+    int k;
+    if (!bloom_size_for(n, fpr, &bits, &k)) return NULL;
+    return bloom_create(bits, k);
+}
@@ -0,0 +1,78 @@
+/**
+ *  bloom_filter.h
+ *
+ *  Cache-line blocked Bloom filter on bit_vector storage.  Every key maps
+ *  to one 64-byte block and sets one bit in each of k of its sixteen
+ *  32-bit lanes, so insert and query touch a single cache line and are
+ *  done with two 256-bit masks.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BLOOM_BLOCK_BITS 512
+#define BLOOM_MAX_K 16
+
+struct bloom_filter {
+    struct bit_vector* bv;
+    // number of 64-byte blocks
+    elem_t blocks;
+    // bits set per key, 1..BLOOM_MAX_K
+    int k;
+};
+
+// bit_size is rounded up to whole blocks
+struct bloom_filter*
+bloom_create(elem_t bit_size, int k);
+
+/**
+ * Sizing helper: smallest filter (in bits) and its k such that n keys
+ * give a false positive rate of at most fpr.  Accounts for the uneven
+ * block load of blocked filters.  Returns false if fpr is not reachable.
+ */
+bool
+bloom_size_for(elem_t n, double fpr, elem_t* bit_size, int* k);
+
+// bloom_create() with the parameters from bloom_size_for()
+struct bloom_filter*
+bloom_create_for(elem_t n, double fpr);
+
+void
+bloom_destroy(struct bloom_filter* bf);
+
+void
+bloom_insert(struct bloom_filter* bf, uint64_t key);
+
+bool
+bloom_query(struct bloom_filter* bf, uint64_t key);
+
+/**
+ * Batched variants: all hashes are computed and the blocks prefetched a
+ * few keys ahead, so the cache misses of a batch overlap.
+ */
+void
+bloom_insert_batch(struct bloom_filter* bf, const uint64_t* keys, elem_t n);
+
+// out[i] is set to whether keys[i] may be present; returns the hit count
+elem_t
+bloom_query_batch(struct bloom_filter* bf, const uint64_t* keys, elem_t n,
+                  bool* out);
+
+// expected false positive rate after n insertions
+double
+bloom_fpr(elem_t bit_size, int k, elem_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ *  bv_stats.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "bv_stats.h"
+
+static const char* op_names[BV_OP_NUM] = {
+    "not", "and", "or", "xor", "multiple_and", "popcount", "scan", "topk",
+};
+
+const char*
+bv_stats_op_name(enum bv_stat_op op)
+{
+    return op < BV_OP_NUM ? op_names[op] : "?";
+}
+
+#ifdef BV_STATS
+
+__thread struct bv_stats_block* bv_stats_local;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+// live thread blocks
+static struct bv_stats_block* blocks;
+// counts of threads that have exited
+static struct bv_stats retired;
+
+static void
+merge(struct bv_stats* dst, struct bv_stats* src)
+{
+    for (int op = 0; op < BV_OP_NUM; ++op) {
+        struct bv_op_stats* d = &dst->ops[op];
+        struct bv_op_stats* s = &src->ops[op];
+        d->count += __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+        d->bytes += __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+        d->samples += __atomic_load_n(&s->samples, __ATOMIC_RELAXED);
+        d->cycles += __atomic_load_n(&s->cycles, __ATOMIC_RELAXED);
+        for (int b = 0; b < BV_STATS_BUCKETS; ++b)
+            d->hist[b] += __atomic_load_n(&s->hist[b], __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * thread exit: fold the block into retired.  bv_stats_local is cleared
+ * so that ops run by later destructors register a fresh block, which
+ * the next destructor round folds in turn, instead of freed memory.
+ */
+static void
+release(void* arg)
+{
+    struct bv_stats_block* b = (struct bv_stats_block*) arg;
+    bv_stats_local = NULL;
+    pthread_mutex_lock(&lock);
+    merge(&retired, &b->s);
+    for (struct bv_stats_block** p = &blocks; *p; p = &(*p)->next) {
+        if (*p == b) {
+            *p = b->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    free(b);
+}
+
+static void
+init_key(void)
+{
+    pthread_key_create(&key, release);
+}
+
+struct bv_stats_block*
+bv_stats_register(void)
+{
+    pthread_once(&once, init_key);
+    void* p;
+    if (posix_memalign(&p, 64, sizeof(struct bv_stats_block))) return NULL;
+    struct bv_stats_block* b = (struct bv_stats_block*) p;
+    memset(b, 0, sizeof(*b));
+    pthread_mutex_lock(&lock);
+    b->next = blocks;
+    blocks = b;
+    pthread_mutex_unlock(&lock);
+    pthread_setspecific(key, b);
+    bv_stats_local = b;
+    return b;
+}
+
+void
+bv_stats_snapshot(struct bv_stats* out)
+{
+    memset(out, 0, sizeof(*out));
+    pthread_mutex_lock(&lock);
+    merge(out, &retired);
+    for (struct bv_stats_block* b = blocks; b; b = b->next)
+        merge(out, &b->s);
+    pthread_mutex_unlock(&lock);
+}
+
+// upper bound of the bucket holding the q-quantile call
+static uint64_t
+percentile(struct bv_op_stats* s, double q)
+{
+    uint64_t rank = (uint64_t) (s->samples * q), seen = 0;
+    for (int b = 0; b < BV_STATS_BUCKETS; ++b) {
+        seen += s->hist[b];
+        if (seen > rank) return b < 63 ? 2ULL << b : UINT64_MAX;
+    }
+    return 0;
+}
+
+#else
+
+void
+bv_stats_snapshot(struct bv_stats* out)
+{
+    memset(out, 0, sizeof(*out));
+}
+
+#endif
+
+void
+bv_stats_dump(FILE* fp)
+{
+#ifndef BV_STATS
+    fprintf(fp, "bv_stats: disabled at compile time (build with -DBV_STATS)\n");
+#else
+    struct bv_stats st;
+    bv_stats_snapshot(&st);
+    fprintf(fp, "%-14s %12s %16s %12s %12s %12s\n",
+            "op", "calls", "bytes", "mean cyc", "p50 cyc<=", "p99 cyc<=");
+    for (int op = 0; op < BV_OP_NUM; ++op) {
+        struct bv_op_stats* s = &st.ops[op];
+        if (s->count == 0) continue;
+        fprintf(fp, "%-14s %12lu %16lu %12lu %12lu %12lu\n",
+                op_names[op], s->count, s->bytes,
+                s->samples ? s->cycles / s->samples : 0,
+                percentile(s, 0.5), percentile(s, 0.99));
+    }
+#endif
+}
@@ -0,0 +1,132 @@
+/**
+ *  bv_stats.h
+ *
+ *  Optional per-operation statistics: call counts, bytes of operand data
+ *  read and a log2 histogram of rdtsc cycles per call.  Build with
+ *  -DBV_STATS (make STATS=1) to enable; otherwise the hooks compile to
+ *  nothing and snapshots read as zero.
+ *
+ *  Every thread counts into its own cache-line aligned block, written
+ *  only by that thread, so a hook is a handful of adds.  Only one call in
+ *  BV_STATS_SAMPLE is timed, as rdtsc alone can cost tens of nanoseconds
+ *  under virtualization.  Snapshots merge the blocks of all live and
+ *  exited threads.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef BV_STATS_H
+#define BV_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef BV_STATS
+#include <x86intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bucket b counts calls of [2^b, 2^(b+1)) cycles
+#define BV_STATS_BUCKETS 64
+
+// time one call in this many per thread, a power of two
+#ifndef BV_STATS_SAMPLE
+#define BV_STATS_SAMPLE 16
+#endif
+
+enum bv_stat_op {
+    BV_OP_NOT,
+    BV_OP_AND,
+    BV_OP_OR,
+    BV_OP_XOR,
+    BV_OP_MULTIPLE_AND,
+    BV_OP_POPCOUNT,
+    BV_OP_SCAN,
+    BV_OP_TOPK,
+    BV_OP_NUM,
+};
+
+struct bv_op_stats {
+    uint64_t count;
+    uint64_t bytes;
+    // timed calls and their total cycles
+    uint64_t samples;
+    uint64_t cycles;
+    uint64_t hist[BV_STATS_BUCKETS];
+} __attribute__((aligned(64)));
+
+struct bv_stats {
+    struct bv_op_stats ops[BV_OP_NUM];
+};
+
+const char*
+bv_stats_op_name(enum bv_stat_op op);
+
+// sums the counters of every thread into out
+void
+bv_stats_snapshot(struct bv_stats* out);
+
+// snapshot as a table: calls, bytes, mean and percentile cycles per op
+void
+bv_stats_dump(FILE* fp);
+
+#ifdef BV_STATS
+
+struct bv_stats_block {
+    struct bv_stats s;
+    uint64_t tick;
+    struct bv_stats_block* next;
+} __attribute__((aligned(64)));
+
+extern __thread struct bv_stats_block* bv_stats_local;
+
+struct bv_stats_block*
+bv_stats_register(void);
+
+// only the owning thread writes; relaxed stores keep snapshot reads sane
+#define BV_STATS_ADD(p, v) \
+    __atomic_store_n(&(p), (p) + (v), __ATOMIC_RELAXED)
+
+// start timestamp of a sampled call, 0 otherwise
+static inline uint64_t
+bv_stats_start(void)
+{
+    struct bv_stats_block* b = bv_stats_local;
+    if (__builtin_expect(b == NULL, 0)) b = bv_stats_register();
+    if (b == NULL || (b->tick++ & (BV_STATS_SAMPLE - 1))) return 0;
+    return __rdtsc();
+}
+
+static inline void
+bv_stats_record(enum bv_stat_op op, uint64_t bytes, uint64_t t0)
+{
+    struct bv_stats_block* b = bv_stats_local;
+    if (b == NULL) return;
+    struct bv_op_stats* s = &b->s.ops[op];
+    BV_STATS_ADD(s->count, 1);
+    BV_STATS_ADD(s->bytes, bytes);
+    if (t0) {
+        uint64_t cycles = __rdtsc() - t0;
+        BV_STATS_ADD(s->samples, 1);
+        BV_STATS_ADD(s->cycles, cycles);
+        BV_STATS_ADD(s->hist[63 - __builtin_clzll(cycles | 1)], 1);
+    }
+}
+
+#define BV_STATS_BEGIN() uint64_t bv_stats_t0 = bv_stats_start()
+#define BV_STATS_END(op, bytes) bv_stats_record(op, bytes, bv_stats_t0)
+
+#else
+
+#define BV_STATS_BEGIN() do {} while (0)
+#define BV_STATS_END(op, bytes) do {} while (0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,461 @@
+/**
+ *  file_vector.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "file_vector.h"
+
+#define FV_MAGIC "BITVEC1"
+#define FV_ALIGN 4096
+
+struct fv_header {
+    char magic[8];
+    uint64_t size;
+};
+
+static inline elem_t
+data_bytes(elem_t bit_size)
+{
+    return ROUNDUP8(bit_size) >> 3;
+}
+
+/**
+ * Chunk buffers are regular bit vectors so the in-memory kernels can run
+ * on them unchanged.  The header is placed right below a 4 KiB boundary
+ * so that arr itself satisfies the O_DIRECT alignment.
+ */
+static struct bit_vector*
+chunk_create(void)
+{
+    void* p;
+    if (posix_memalign(&p, FV_ALIGN, FV_ALIGN + FV_CHUNK_SIZE)) return NULL;
+    struct bit_vector* bv = (struct bit_vector*)
+        ((uint8_t*) p + FV_ALIGN - offsetof(struct bit_vector, arr));
+    bv->allocated = FV_CHUNK_SIZE;
+    bv->size = FV_CHUNK_SIZE << 3;
+    return bv;
+}
+
+static void
+chunk_destroy(struct bit_vector* bv)
+{
+    if (bv == NULL) return;
+    free((uint8_t*) bv + offsetof(struct bit_vector, arr) - FV_ALIGN);
+}
+
+static int
+open_flags(int flags)
+{
+    return (flags & FV_DIRECT) ? O_DIRECT : 0;
+}
+
+struct file_vector*
+fv_create(const char* path, elem_t bit_size, int flags)
+{
+    struct file_vector* fv = (struct file_vector*) malloc(sizeof(*fv));
+    if (fv == NULL) return NULL;
+
+    fv->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | open_flags(flags), 0644);
+    if (fv->fd < 0) goto err0;
+    fv->flags = flags;
+    fv->size = bit_size;
+
+    void* block;
+    if (posix_memalign(&block, FV_ALIGN, FV_DATA_OFFSET)) goto err1;
+    memset(block, 0, FV_DATA_OFFSET);
+    struct fv_header* hdr = (struct fv_header*) block;
+    memcpy(hdr->magic, FV_MAGIC, sizeof(hdr->magic));
+    hdr->size = bit_size;
+    ssize_t n = pwrite(fv->fd, block, FV_DATA_OFFSET, 0);
+    free(block);
+    if (n != FV_DATA_OFFSET) goto err1;
+
+    off_t len = FV_DATA_OFFSET + ROUNDUP4K(data_bytes(bit_size));
+    if (ftruncate(fv->fd, len)) goto err1;
+    return fv;
+
+err1:
+    close(fv->fd);
+err0:
+    free(fv);
+    return NULL;
+}
+
+struct file_vector*
+fv_open(const char* path, int flags)
+{
+    struct file_vector* fv = (struct file_vector*) malloc(sizeof(*fv));
+    if (fv == NULL) return NULL;
+
+    fv->fd = open(path, O_RDWR | open_flags(flags));
+    if (fv->fd < 0) goto err0;
+    fv->flags = flags;
+
+    void* block;
+    if (posix_memalign(&block, FV_ALIGN, FV_DATA_OFFSET)) goto err1;
+    ssize_t n = pread(fv->fd, block, FV_DATA_OFFSET, 0);
+    struct fv_header* hdr = (struct fv_header*) block;
+    if (n != FV_DATA_OFFSET || memcmp(hdr->magic, FV_MAGIC, sizeof(hdr->magic))) {
+        free(block);
+        errno = EINVAL;
+        goto err1;
+    }
+    fv->size = hdr->size;
+    free(block);
+
+    if (!(flags & FV_DIRECT))
+        posix_fadvise(fv->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fv;
+
+err1:
+    close(fv->fd);
+err0:
+    free(fv);
+    return NULL;
+}
+
+void
+fv_close(struct file_vector* fv)
+{
+    close(fv->fd);
+    free(fv);
+}
+
+// O_DIRECT transfers must cover whole 4 KiB blocks
+static inline elem_t
+io_len(struct file_vector* fv, elem_t len)
+{
+    return (fv->flags & FV_DIRECT) ? ROUNDUP4K(len) : len;
+}
+
+static bool
+read_chunk(struct file_vector* fv, struct bit_vector* buf,
+           elem_t offset, elem_t len)
+{
+    elem_t total = io_len(fv, len), done = 0;
+    while (done < total) {
+        ssize_t n = pread(fv->fd, buf->arr + done, total - done,
+                          FV_DATA_OFFSET + offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return false;
+        if (n == 0) break;
+        done += n;
+    }
+    if (done < len) {
+        errno = EIO;
+        return false;
+    }
+    // the kernels always run over the whole chunk
+    if (len < FV_CHUNK_SIZE)
+        memset(buf->arr + len, 0, FV_CHUNK_SIZE - len);
+    return true;
+}
+
+static bool
+write_chunk(struct file_vector* fv, struct bit_vector* buf,
+            elem_t offset, elem_t len)
+{
+    // the last chunk ends at size: clear the bits above it and the padding
+    if (offset + len == data_bytes(fv->size)) {
+        if (fv->size & 7) buf->arr[len - 1] &= (1U << (fv->size & 7)) - 1;
+        memset(buf->arr + len, 0, io_len(fv, len) - len);
+    }
+
+    elem_t total = io_len(fv, len), done = 0;
+    while (done < total) {
+        ssize_t n = pwrite(fv->fd, buf->arr + done, total - done,
+                           FV_DATA_OFFSET + offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        done += n;
+    }
+    return true;
+}
+
+enum fv_op {
+    FV_AND,
+    FV_OR,
+    FV_XOR,
+    FV_NOT,
+    FV_MULTIPLE_AND,
+    FV_MULTIPLE_OR,
+    FV_POPCOUNT,
+};
+
+struct fv_slot {
+    struct bit_vector** in;
+    struct bit_vector* out;
+    elem_t offset;
+    elem_t len;
+    // free -> (reader) -> full -> (compute) -> done -> (writer) -> free
+    sem_t free;
+    sem_t full;
+    sem_t done;
+};
+
+struct fv_job {
+    enum fv_op op;
+    struct file_vector* dst;
+    struct file_vector** srcs;
+    int num;
+    elem_t bytes;
+    elem_t chunks;
+    elem_t popcount;
+    volatile int error;
+    struct fv_slot slots[2];
+};
+
+static void*
+reader_main(void* arg)
+{
+    struct fv_job* job = (struct fv_job*) arg;
+    for (elem_t c = 0; c < job->chunks; ++c) {
+        struct fv_slot* slot = &job->slots[c & 1];
+        sem_wait(&slot->free);
+        slot->offset = c * FV_CHUNK_SIZE;
+        slot->len = min(job->bytes - slot->offset, FV_CHUNK_SIZE);
+        for (int i = 0; i < job->num && !job->error; ++i) {
+            if (!read_chunk(job->srcs[i], slot->in[i], slot->offset, slot->len))
+                __sync_bool_compare_and_swap(&job->error, 0, errno);
+        }
+        sem_post(&slot->full);
+    }
+    return NULL;
+}
+
+static void*
+writer_main(void* arg)
+{
+    struct fv_job* job = (struct fv_job*) arg;
+    for (elem_t c = 0; c < job->chunks; ++c) {
+        struct fv_slot* slot = &job->slots[c & 1];
+        sem_wait(&slot->done);
+        if (!job->error &&
+            !write_chunk(job->dst, slot->out, slot->offset, slot->len))
+            __sync_bool_compare_and_swap(&job->error, 0, errno);
+        sem_post(&slot->free);
+    }
+    return NULL;
+}
+
+static void
+compute_chunk(struct fv_job* job, struct fv_slot* slot)
+{
+    struct bit_vector** in = slot->in;
+    struct bit_vector* out = slot->out;
+    switch (job->op) {
+    case FV_AND:
+        bv_and_with_dst_256(out, in[0], in[1]);
+        break;
+    case FV_OR:
+        bv_or_with_dst(out, in[0], in[1]);
+        break;
+    case FV_XOR:
+        bv_xor_with_dst(out, in[0], in[1]);
+        break;
+    case FV_NOT:
+        bv_not_with_dst(out, in[0]);
+        break;
+    case FV_MULTIPLE_AND:
+        bv_multiple_and_256(out, in, job->num);
+        break;
+    case FV_MULTIPLE_OR:
+        if (job->num == 1) {
+            memcpy(out->arr, in[0]->arr, out->allocated);
+            break;
+        }
+        bv_or_with_dst(out, in[0], in[1]);
+        for (int i = 2; i < job->num; ++i)
+            bv_or_overwirte(out, in[i]);
+        break;
+    case FV_POPCOUNT:
+        job->popcount += bv_popcount(in[0]);
+        break;
+    }
+}
+
+static bool
+fv_run(enum fv_op op, struct file_vector* dst,
+       struct file_vector** srcs, int num, elem_t bit_size, elem_t* popcount)
+{
+    assert(num > 0);
+    for (int i = 0; i < num; ++i)
+        assert(srcs[i]->size >= bit_size);
+
+    struct fv_job job;
+    memset(&job, 0, sizeof(job));
+    job.op = op;
+    job.dst = dst;
+    job.srcs = srcs;
+    job.num = num;
+    job.bytes = data_bytes(bit_size);
+    job.chunks = (job.bytes + FV_CHUNK_SIZE - 1) / FV_CHUNK_SIZE;
+
+    bool ok = false;
+    int s = 0;
+    for (; s < 2; ++s) {
+        struct fv_slot* slot = &job.slots[s];
+        slot->in = (struct bit_vector**) calloc(num, sizeof(*slot->in));
+        if (slot->in == NULL) goto out;
+        for (int i = 0; i < num; ++i)
+            if ((slot->in[i] = chunk_create()) == NULL) goto out;
+        if (dst && (slot->out = chunk_create()) == NULL) goto out;
+        sem_init(&slot->free, 0, 1);
+        sem_init(&slot->full, 0, 0);
+        sem_init(&slot->done, 0, 0);
+    }
+
+    pthread_t reader, writer;
+    if ((errno = pthread_create(&reader, NULL, reader_main, &job))) goto out;
+    if (dst && (errno = pthread_create(&writer, NULL, writer_main, &job))) {
+        job.error = errno;
+        // let the reader run to completion without doing I/O
+        for (elem_t c = 0; c < job.chunks; ++c) {
+            sem_wait(&job.slots[c & 1].full);
+            sem_post(&job.slots[c & 1].free);
+        }
+        pthread_join(reader, NULL);
+        goto out;
+    }
+
+    for (elem_t c = 0; c < job.chunks; ++c) {
+        struct fv_slot* slot = &job.slots[c & 1];
+        sem_wait(&slot->full);
+        if (!job.error) {
+            // bv_not_with_dst() clears everything past out->size
+            if (slot->out) slot->out->size = slot->len << 3;
+            compute_chunk(&job, slot);
+        }
+        sem_post(dst ? &slot->done : &slot->free);
+    }
+
+    pthread_join(reader, NULL);
+    if (dst) pthread_join(writer, NULL);
+    if (job.error) errno = job.error;
+    else ok = true;
+    if (popcount) *popcount = job.popcount;
+
+out:
+    for (int i = 0; i < 2; ++i) {
+        struct fv_slot* slot = &job.slots[i];
+        if (i < s) {
+            sem_destroy(&slot->free);
+            sem_destroy(&slot->full);
+            sem_destroy(&slot->done);
+        }
+        if (slot->in) {
+            for (int j = 0; j < num; ++j) chunk_destroy(slot->in[j]);
+            free(slot->in);
+        }
+        chunk_destroy(slot->out);
+    }
+    return ok;
+}
+
+bool
+fv_and(struct file_vector* dst,
+       struct file_vector* fv1, struct file_vector* fv2)
+{
+    struct file_vector* srcs[2] = { fv1, fv2 };
+    return fv_run(FV_AND, dst, srcs, 2, dst->size, NULL);
+}
+
+bool
+fv_or(struct file_vector* dst,
+      struct file_vector* fv1, struct file_vector* fv2)
+{
+    struct file_vector* srcs[2] = { fv1, fv2 };
+    return fv_run(FV_OR, dst, srcs, 2, dst->size, NULL);
+}
+
+bool
+fv_xor(struct file_vector* dst,
+       struct file_vector* fv1, struct file_vector* fv2)
+{
+    struct file_vector* srcs[2] = { fv1, fv2 };
+    return fv_run(FV_XOR, dst, srcs, 2, dst->size, NULL);
+}
+
+bool
+fv_not(struct file_vector* dst, struct file_vector* fv)
+{
+    return fv_run(FV_NOT, dst, &fv, 1, dst->size, NULL);
+}
+
+bool
+fv_multiple_and(struct file_vector* dst,
+                struct file_vector** fvs, int fv_num)
+{
+    return fv_run(FV_MULTIPLE_AND, dst, fvs, fv_num, dst->size, NULL);
+}
+
+bool
+fv_multiple_or(struct file_vector* dst,
+               struct file_vector** fvs, int fv_num)
+{
+    return fv_run(FV_MULTIPLE_OR, dst, fvs, fv_num, dst->size, NULL);
+}
+
+bool
+fv_popcount(struct file_vector* fv, elem_t* count)
+{
+    return fv_run(FV_POPCOUNT, NULL, &fv, 1, fv->size, count);
+}
+
+bool
+fv_store(struct file_vector* fv, struct bit_vector* bv)
+{
+    assert(fv->size == bv->size);
+    struct bit_vector* buf = chunk_create();
+    if (buf == NULL) return false;
+
+    bool ok = true;
+    elem_t bytes = data_bytes(fv->size);
+    for (elem_t off = 0; off < bytes && ok; off += FV_CHUNK_SIZE) {
+        elem_t len = min(bytes - off, FV_CHUNK_SIZE);
+        memcpy(buf->arr, bv->arr + off, len);
+        ok = write_chunk(fv, buf, off, len);
+    }
+    chunk_destroy(buf);
+    return ok;
+}
+
+struct bit_vector*
+fv_load(struct file_vector* fv)
+{
+    struct bit_vector* bv = bv_create(fv->size);
+    struct bit_vector* buf = chunk_create();
+    if (bv == NULL || buf == NULL) goto err;
+
+    elem_t bytes = data_bytes(fv->size);
+    for (elem_t off = 0; off < bytes; off += FV_CHUNK_SIZE) {
+        elem_t len = min(bytes - off, FV_CHUNK_SIZE);
+        if (!read_chunk(fv, buf, off, len)) goto err;
+        memcpy(bv->arr + off, buf->arr, len);
+    }
+    chunk_destroy(buf);
+    return bv;
+
+err:
+    chunk_destroy(buf);
+    if (bv) bv_destroy(bv);
+    return NULL;
+}
@@ -0,0 +1,97 @@
+/**
+ *  file_vector.h
+ *
+ *  File-backed bit vectors and an out-of-core engine that runs the bulk
+ *  operations chunk by chunk, for vectors that do not fit in memory.
+ *
+ *  On disk a vector is a FV_DATA_OFFSET byte header followed by the same
+ *  byte layout as bit_vector.arr, padded to a 4 KiB multiple so the file
+ *  can be read with O_DIRECT.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef FILE_VECTOR_H
+#define FILE_VECTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FV_DATA_OFFSET 4096
+
+// bytes per operand read in one go; must be a multiple of 4 KiB
+#ifndef FV_CHUNK_SIZE
+#define FV_CHUNK_SIZE (8UL << 20)
+#endif
+
+// open flags
+#define FV_DIRECT 0x1
+
+struct file_vector {
+    int fd;
+    int flags;
+    // available bit length
+    elem_t size;
+};
+
+// creates (or truncates) path holding bit_size clear bits
+struct file_vector*
+fv_create(const char* path, elem_t bit_size, int flags);
+
+struct file_vector*
+fv_open(const char* path, int flags);
+
+void
+fv_close(struct file_vector* fv);
+
+// copies an in-memory vector into fv, which must have the same size
+bool
+fv_store(struct file_vector* fv, struct bit_vector* bv);
+
+// reads the whole vector into memory
+struct bit_vector*
+fv_load(struct file_vector* fv);
+
+/**
+ * Bulk operations.  dst->size bits are processed, every source must be at
+ * least that long; dst may also be one of the sources.  Operand chunks
+ * are read by an I/O thread and results written by another while the
+ * calling thread runs the in-memory kernels, so with two chunk buffers in
+ * flight the disk is the bottleneck.  On I/O failure false is returned
+ * and errno is set.
+ */
+bool
+fv_and(struct file_vector* dst,
+       struct file_vector* fv1, struct file_vector* fv2);
+
+bool
+fv_or(struct file_vector* dst,
+      struct file_vector* fv1, struct file_vector* fv2);
+
+bool
+fv_xor(struct file_vector* dst,
+       struct file_vector* fv1, struct file_vector* fv2);
+
+bool
+fv_not(struct file_vector* dst, struct file_vector* fv);
+
+bool
+fv_multiple_and(struct file_vector* dst,
+                struct file_vector** fvs, int fv_num);
+
+bool
+fv_multiple_or(struct file_vector* dst,
+               struct file_vector** fvs, int fv_num);
+
+bool
+fv_popcount(struct file_vector* fv, elem_t* count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
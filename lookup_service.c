@@ -0,0 +1,330 @@
+/**
+ *  lookup_service.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "lookup_service.h"
+
+#define CACHE_LINE 64
+// power of two sizes
+#define LS_DEQUE_SIZE 1024
+#define LS_INBOX_SIZE 1024
+#define LS_RING_SIZE 4096
+// spins before an idle worker yields the CPU
+#define LS_IDLE_SPINS 256
+
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+struct ls_task {
+    const struct lookup_query* queries;
+    int num;
+};
+
+/**
+ * Chase-Lev deque.  The owner pushes and pops at bottom, thieves take
+ * from top; only the last element needs a CAS between the two.
+ */
+struct ws_deque {
+    int64_t top __attribute__((aligned(CACHE_LINE)));
+    int64_t bottom __attribute__((aligned(CACHE_LINE)));
+    struct ls_task buf[LS_DEQUE_SIZE] __attribute__((aligned(CACHE_LINE)));
+};
+
+// single-producer single-consumer rings
+struct task_ring {
+    uint64_t head __attribute__((aligned(CACHE_LINE)));
+    uint64_t tail __attribute__((aligned(CACHE_LINE)));
+    struct ls_task buf[LS_INBOX_SIZE] __attribute__((aligned(CACHE_LINE)));
+};
+
+struct result_ring {
+    uint64_t head __attribute__((aligned(CACHE_LINE)));
+    uint64_t tail __attribute__((aligned(CACHE_LINE)));
+    struct lookup_result buf[LS_RING_SIZE] __attribute__((aligned(CACHE_LINE)));
+};
+
+struct ls_worker {
+    struct lookup_service* ls;
+    int id;
+    int cpu;
+    pthread_t tid;
+    uint32_t seed;
+    // per-worker dst, allocated separately so workers never share lines
+    struct bit_vector* scratch;
+    struct ws_deque deque;
+    struct task_ring inbox;
+    struct result_ring done;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct lookup_service {
+    struct bit_vector** set;
+    int set_num;
+    // allocated and started workers
+    int capacity;
+    int nworkers;
+    // next worker to receive a task
+    int next;
+    // set by ls_destroy, polled by the workers with atomic loads
+    int stop;
+    struct ls_worker* workers;
+};
+
+static bool
+deque_push(struct ws_deque* d, struct ls_task task)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    int64_t t = load_acquire(&d->top);
+    if (b - t >= LS_DEQUE_SIZE) return false;
+    d->buf[b & (LS_DEQUE_SIZE - 1)] = task;
+    store_release(&d->bottom, b + 1);
+    return true;
+}
+
+static bool
+deque_pop(struct ws_deque* d, struct ls_task* task)
+{
+    int64_t b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    *task = d->buf[b & (LS_DEQUE_SIZE - 1)];
+    if (t == b) {
+        // last element, race against thieves
+        bool won = __atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                               __ATOMIC_SEQ_CST,
+                                               __ATOMIC_RELAXED);
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return won;
+    }
+    return true;
+}
+
+static bool
+deque_steal(struct ws_deque* d, struct ls_task* task)
+{
+    int64_t t = load_acquire(&d->top);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t b = load_acquire(&d->bottom);
+    if (t >= b) return false;
+    *task = d->buf[t & (LS_DEQUE_SIZE - 1)];
+    return __atomic_compare_exchange_n(&d->top, &t, t + 1, false,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static bool
+inbox_put(struct task_ring* r, struct ls_task task)
+{
+    uint64_t tail = r->tail;
+    if (tail - load_acquire(&r->head) >= LS_INBOX_SIZE) return false;
+    r->buf[tail & (LS_INBOX_SIZE - 1)] = task;
+    store_release(&r->tail, tail + 1);
+    return true;
+}
+
+static bool
+inbox_peek(struct task_ring* r, struct ls_task* task)
+{
+    uint64_t head = r->head;
+    if (head == load_acquire(&r->tail)) return false;
+    *task = r->buf[head & (LS_INBOX_SIZE - 1)];
+    return true;
+}
+
+static void
+inbox_drop(struct task_ring* r)
+{
+    store_release(&r->head, r->head + 1);
+}
+
+static void
+complete(struct ls_worker* w, void* cookie, int64_t match)
+{
+    struct result_ring* r = &w->done;
+    uint64_t tail = r->tail;
+    // back-pressure: wait for the poller instead of dropping results
+    while (tail - load_acquire(&r->head) >= LS_RING_SIZE) {
+        if (__atomic_load_n(&w->ls->stop, __ATOMIC_RELAXED)) return;
+        sched_yield();
+    }
+    r->buf[tail & (LS_RING_SIZE - 1)].cookie = cookie;
+    r->buf[tail & (LS_RING_SIZE - 1)].match = match;
+    store_release(&r->tail, tail + 1);
+}
+
+static void
+run_task(struct ls_worker* w, struct ls_task* task)
+{
+    struct lookup_service* ls = w->ls;
+    struct bit_vector* bvs[LS_MAX_OPERANDS];
+    for (int i = 0; i < task->num; ++i) {
+        const struct lookup_query* q = &task->queries[i];
+        assert(q->num > 0 && q->num <= LS_MAX_OPERANDS);
+        for (int j = 0; j < q->num; ++j) {
+            assert(q->ids[j] < (uint32_t) ls->set_num);
+            bvs[j] = ls->set[q->ids[j]];
+        }
+        bv_multiple_and_256(w->scratch, bvs, q->num);
+        complete(w, q->cookie, bv_ffs(w->scratch));
+    }
+}
+
+static bool
+find_task(struct ls_worker* w, struct ls_task* task)
+{
+    struct lookup_service* ls = w->ls;
+    struct ls_task t;
+
+    // move new work into our deque so that others can steal it
+    while (inbox_peek(&w->inbox, &t) && deque_push(&w->deque, t))
+        inbox_drop(&w->inbox);
+    if (deque_pop(&w->deque, task)) return true;
+
+    // steal, starting at a random victim.  nworkers still grows while
+    // the first workers run; capacity is fixed and the deques of workers
+    // not started yet are simply empty
+    w->seed = w->seed * 1103515245 + 12345;
+    int start = (w->seed >> 16) % ls->capacity;
+    for (int i = 0; i < ls->capacity; ++i) {
+        struct ls_worker* v = &ls->workers[(start + i) % ls->capacity];
+        if (v != w && deque_steal(&v->deque, task)) return true;
+    }
+    return false;
+}
+
+static void*
+worker_main(void* arg)
+{
+    struct ls_worker* w = (struct ls_worker*) arg;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+    int idle = 0;
+    struct ls_task task;
+    while (!__atomic_load_n(&w->ls->stop, __ATOMIC_RELAXED)) {
+        if (find_task(w, &task)) {
+            run_task(w, &task);
+            idle = 0;
+        } else if (++idle < LS_IDLE_SPINS) {
+            _mm_pause();
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+struct lookup_service*
+ls_create(struct bit_vector** set, int set_num, int workers, const int* cpus)
+{
+    assert(set_num > 0 && workers > 0);
+    struct lookup_service* ls = (struct lookup_service*) calloc(1, sizeof(*ls));
+    if (ls == NULL) return NULL;
+    ls->set = set;
+    ls->set_num = set_num;
+
+    void* p;
+    if (posix_memalign(&p, CACHE_LINE, sizeof(struct ls_worker) * workers))
+        goto err0;
+    memset(p, 0, sizeof(struct ls_worker) * workers);
+    ls->workers = (struct ls_worker*) p;
+    ls->capacity = workers;
+
+    elem_t size = set[0]->size;
+    for (int i = 1; i < set_num; ++i)
+        size = min(size, set[i]->size);
+
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) ncpu = 1;
+    for (int i = 0; i < workers; ++i) {
+        struct ls_worker* w = &ls->workers[i];
+        w->ls = ls;
+        w->id = i;
+        w->cpu = cpus ? cpus[i] : (int) (i % ncpu);
+        w->seed = i + 1;
+        w->scratch = bv_create(size);
+        if (w->scratch == NULL) goto err1;
+    }
+
+    for (; ls->nworkers < workers; ++ls->nworkers) {
+        struct ls_worker* w = &ls->workers[ls->nworkers];
+        if (pthread_create(&w->tid, NULL, worker_main, w)) goto err1;
+    }
+    return ls;
+
+err1:
+    ls_destroy(ls);
+    return NULL;
+err0:
+    free(ls);
+    return NULL;
+}
+
+void
+ls_destroy(struct lookup_service* ls)
+{
+    __atomic_store_n(&ls->stop, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < ls->nworkers; ++i)
+        pthread_join(ls->workers[i].tid, NULL);
+    for (int i = 0; i < ls->capacity; ++i) {
+        if (ls->workers[i].scratch) bv_destroy(ls->workers[i].scratch);
+    }
+    free(ls->workers);
+    free(ls);
+}
+
+int
+ls_submit(struct lookup_service* ls, const struct lookup_query* queries, int n)
+{
+    int done = 0;
+    while (done < n) {
+        struct ls_task task = { queries + done, min(n - done, LS_TASK_SIZE) };
+        int tried = 0;
+        while (tried < ls->nworkers &&
+               !inbox_put(&ls->workers[ls->next].inbox, task)) {
+            ls->next = (ls->next + 1) % ls->nworkers;
+            tried++;
+        }
+        if (tried == ls->nworkers) break;
+        ls->next = (ls->next + 1) % ls->nworkers;
+        done += task.num;
+    }
+    return done;
+}
+
+int
+ls_poll(struct lookup_service* ls, struct lookup_result* out, int max)
+{
+    int count = 0;
+    for (int i = 0; i < ls->nworkers && count < max; ++i) {
+        struct result_ring* r = &ls->workers[i].done;
+        uint64_t head = r->head;
+        uint64_t tail = load_acquire(&r->tail);
+        while (head != tail && count < max)
+            out[count++] = r->buf[head++ & (LS_RING_SIZE - 1)];
+        store_release(&r->head, head);
+    }
+    return count;
+}
@@ -0,0 +1,75 @@
+/**
+ *  lookup_service.h
+ *
+ *  Multi-core classification: a pool of pinned workers runs multi-AND
+ *  lookups against one shared, read-only set of bit vectors.
+ *
+ *  Batches are cut into tasks and handed to the workers round robin; a
+ *  worker moves them into its own work-stealing deque and idle workers
+ *  steal from the others.  Every worker owns a cache-aligned scratch dst
+ *  and publishes results in its own single-producer completion ring, so
+ *  the hot path shares no written cache lines and takes no locks.
+ *
+ *  ls_submit() and ls_poll() must each be called from a single thread.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef LOOKUP_SERVICE_H
+#define LOOKUP_SERVICE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LS_MAX_OPERANDS 16
+// queries per task, the unit of work stealing
+#define LS_TASK_SIZE 32
+
+struct lookup_query {
+    // indices into the shared vector set
+    uint32_t ids[LS_MAX_OPERANDS];
+    int num;
+    // handed back untouched with the result
+    void* cookie;
+};
+
+struct lookup_result {
+    void* cookie;
+    // lowest set bit of the intersection, -1 if none
+    int64_t match;
+};
+
+struct lookup_service;
+
+/**
+ * Starts workers threads; worker i is pinned to cpus[i], or to CPU
+ * i % online CPUs if cpus is NULL.  set must stay valid and unmodified
+ * while the service runs.
+ */
+struct lookup_service*
+ls_create(struct bit_vector** set, int set_num, int workers, const int* cpus);
+
+void
+ls_destroy(struct lookup_service* ls);
+
+/**
+ * Queues up to n queries and returns how many were accepted (fewer when
+ * the worker inboxes are full).  The queries are read in place, so the
+ * array must stay valid until all of their results have been polled.
+ */
+int
+ls_submit(struct lookup_service* ls, const struct lookup_query* queries, int n);
+
+// copies up to max finished results to out, returns how many
+int
+ls_poll(struct lookup_service* ls, struct lookup_result* out, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
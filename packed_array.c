@@ -0,0 +1,207 @@
+/**
+ *  packed_array.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "packed_array.h"
+
+// instantiates X for every field width, so the block kernels unroll
+#define PA_WIDTHS(X) \
+    X(1)  X(2)  X(3)  X(4)  X(5)  X(6)  X(7)  X(8)  \
+    X(9)  X(10) X(11) X(12) X(13) X(14) X(15) X(16) \
+    X(17) X(18) X(19) X(20) X(21) X(22) X(23) X(24) \
+    X(25) X(26) X(27) X(28) X(29) X(30) X(31) X(32)
+
+struct packed_array*
+pa_create(elem_t num, int k)
+{
+    if (k < 1 || k > 32) return NULL;
+    struct packed_array* pa = (struct packed_array*) malloc(sizeof(*pa));
+    if (pa == NULL) return NULL;
+    elem_t blocks = (num + PA_BLOCK - 1) / PA_BLOCK;
+    pa->bv = bv_create(blocks * 32 * k * 8);
+    if (pa->bv == NULL) {
+        free(pa);
+        return NULL;
+    }
+    pa->num = num;
+    pa->k = k;
+    return pa;
+}
+
+void
+pa_destroy(struct packed_array* pa)
+{
+    bv_destroy(pa->bv);
+    free(pa);
+}
+
+/**
+ * Block kernels.  Lane j of the vector idx holds value 8 idx + j of the
+ * block; values enter and leave the k words of their lane from the low
+ * bits up, a value straddling two words is split by a pair of shifts.
+ */
+static inline __attribute__((always_inline)) void
+unpack_block(const uint32_t* in, uint32_t* out, const int k)
+{
+    const __m256i mask = _mm256_set1_epi32(KBITS_MASK_32(k));
+    __m256i cur = _mm256_load_si256((__m256i*) in);
+    int sh = 0;
+    for (int idx = 0; idx < 32; ++idx) {
+        __m256i v = _mm256_srli_epi32(cur, sh);
+        if (sh + k > 32) {
+            in += 8;
+            cur = _mm256_load_si256((__m256i*) in);
+            v = _mm256_or_si256(v, _mm256_slli_epi32(cur, 32 - sh));
+            sh += k - 32;
+        } else if (sh + k == 32) {
+            // the last word of the lane is never read past
+            if (idx < 31) {
+                in += 8;
+                cur = _mm256_load_si256((__m256i*) in);
+            }
+            sh = 0;
+        } else {
+            sh += k;
+        }
+        _mm256_storeu_si256((__m256i*) (out + idx * 8), _mm256_and_si256(v, mask));
+    }
+}
+
+static inline __attribute__((always_inline)) void
+pack_block(const uint32_t* in, uint32_t* out, const int k)
+{
+    const __m256i mask = _mm256_set1_epi32(KBITS_MASK_32(k));
+    __m256i acc = _mm256_setzero_si256();
+    int sh = 0;
+    for (int idx = 0; idx < 32; ++idx) {
+        __m256i v = _mm256_and_si256(
+            _mm256_loadu_si256((__m256i*) (in + idx * 8)), mask);
+        acc = _mm256_or_si256(acc, _mm256_slli_epi32(v, sh));
+        if (sh + k >= 32) {
+            _mm256_store_si256((__m256i*) out, acc);
+            out += 8;
+            acc = sh + k > 32 ? _mm256_srli_epi32(v, 32 - sh)
+                              : _mm256_setzero_si256();
+            sh += k - 32;
+        } else {
+            sh += k;
+        }
+    }
+}
+
+static void
+unpack_blocks(const uint32_t* in, uint32_t* out, elem_t blocks, int k)
+{
+    switch (k) {
+#define UNPACK_CASE(K)                                          \
+    case K:                                                     \
+        for (elem_t b = 0; b < blocks; ++b)                     \
+            unpack_block(in + b * 8 * K, out + b * PA_BLOCK, K); \
+        break;
+    PA_WIDTHS(UNPACK_CASE)
+#undef UNPACK_CASE
+    default:
+        assert(false);
+    }
+}
+
+static void
+pack_blocks(const uint32_t* in, uint32_t* out, elem_t blocks, int k)
+{
+    switch (k) {
+#define PACK_CASE(K)                                          \
+    case K:                                                   \
+        for (elem_t b = 0; b < blocks; ++b)                   \
+            pack_block(in + b * PA_BLOCK, out + b * 8 * K, K); \
+        break;
+    PA_WIDTHS(PACK_CASE)
+#undef PACK_CASE
+    default:
+        assert(false);
+    }
+}
+
+void
+pa_unpack(struct packed_array* pa, elem_t from, elem_t n, uint32_t* out)
+{
+    assert(from + n <= pa->num);
+    elem_t i = from, end = from + n;
+    // unaligned head and tail value by value, whole blocks in between
+    for (; i < end && (i & (PA_BLOCK - 1)); ++i)
+        out[i - from] = pa_get(pa, i);
+    elem_t blocks = (end - i) / PA_BLOCK;
+    unpack_blocks((uint32_t*) pa->bv->arr + (i / PA_BLOCK) * 8 * pa->k,
+                  out + (i - from), blocks, pa->k);
+    for (i += blocks * PA_BLOCK; i < end; ++i)
+        out[i - from] = pa_get(pa, i);
+}
+
+void
+pa_pack(struct packed_array* pa, elem_t from, const uint32_t* in, elem_t n)
+{
+    assert(from + n <= pa->num);
+    elem_t i = from, end = from + n;
+    for (; i < end && (i & (PA_BLOCK - 1)); ++i)
+        pa_set(pa, i, in[i - from]);
+    elem_t blocks = (end - i) / PA_BLOCK;
+    pack_blocks(in + (i - from),
+                (uint32_t*) pa->bv->arr + (i / PA_BLOCK) * 8 * pa->k,
+                blocks, pa->k);
+    for (i += blocks * PA_BLOCK; i < end; ++i)
+        pa_set(pa, i, in[i - from]);
+}
+
+void
+pa_compare(struct bit_vector* dst, struct packed_array* pa,
+           enum pa_cmp op, uint32_t val)
+{
+    assert(dst->size >= pa->num);
+    uint32_t buf[PA_BLOCK] __attribute__((aligned(32)));
+    const __m256i c = _mm256_set1_epi32(val);
+    // LT, GT and NE are the complements of GE, LE and EQ
+    int flip = (op == PA_NE || op == PA_LT || op == PA_GT) ? 0xff : 0;
+    elem_t blocks = (pa->num + PA_BLOCK - 1) / PA_BLOCK;
+    const uint32_t* in = (uint32_t*) pa->bv->arr;
+
+    for (elem_t b = 0; b < blocks; ++b) {
+        unpack_blocks(in + b * 8 * pa->k, buf, 1, pa->k);
+        // value 8 idx + j of the block is lane j, so each vector makes a byte
+        uint8_t* res = dst->arr + b * (PA_BLOCK / 8);
+        for (int idx = 0; idx < 32; ++idx) {
+            __m256i v = _mm256_load_si256((__m256i*) (buf + idx * 8));
+            __m256i m;
+            switch (op) {
+            case PA_EQ:
+            case PA_NE:
+                m = _mm256_cmpeq_epi32(v, c);
+                break;
+            case PA_LE:
+            case PA_GT:
+                m = _mm256_cmpeq_epi32(_mm256_min_epu32(v, c), v);
+                break;
+            default:
+                m = _mm256_cmpeq_epi32(_mm256_max_epu32(v, c), v);
+                break;
+            }
+            res[idx] = _mm256_movemask_ps(_mm256_castsi256_ps(m)) ^ flip;
+        }
+    }
+
+    // the zero padding of the last block may have matched
+    elem_t byte = pa->num >> 3;
+    if (pa->num & 7) dst->arr[byte++] &= (1 << (pa->num & 7)) - 1;
+    memset(dst->arr + byte, 0, dst->allocated - byte);
+}
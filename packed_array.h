@@ -0,0 +1,109 @@
+/**
+ *  packed_array.h
+ *
+ *  Arrays of k-bit unsigned integers (1 <= k <= 32) packed into
+ *  bit_vector storage.  Values are kept in blocks of 256 laid out for
+ *  8 x 32-bit SIMD lanes: value r of a block goes to lane r % 8, and each
+ *  lane packs its 32 values back to back into k consecutive words of the
+ *  lane.  Bulk pack, unpack and compare then work on 8 values per shift
+ *  with no shuffles, while get/set stay O(1).
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef PACKED_ARRAY_H
+#define PACKED_ARRAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "bit_utils.h"
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// values per block; a block takes 32 k bytes
+#define PA_BLOCK 256
+
+struct packed_array {
+    // number of values
+    elem_t num;
+    // bits per value
+    int k;
+    struct bit_vector* bv;
+};
+
+enum pa_cmp {
+    PA_EQ,
+    PA_NE,
+    PA_LT,
+    PA_LE,
+    PA_GT,
+    PA_GE,
+};
+
+// word holding the low bits of value i and the bit they start at
+static inline uint32_t*
+pa_locate(struct packed_array* pa, elem_t i, int* shift)
+{
+    uint32_t* w = (uint32_t*) pa->bv->arr + (i >> 8) * 8 * pa->k + (i & 7);
+    int bit = (int) ((i >> 3) & 31) * pa->k;
+    *shift = bit & 31;
+    return w + (bit >> 5) * 8;
+}
+
+static inline uint32_t
+pa_get(struct packed_array* pa, elem_t i)
+{
+    assert(i < pa->num);
+    int sh;
+    uint32_t* w = pa_locate(pa, i, &sh);
+    uint64_t v = w[0];
+    // the next word of the same lane is 8 words on
+    if (sh + pa->k > 32) v |= (uint64_t) w[8] << 32;
+    return (uint32_t) (v >> sh) & KBITS_MASK_32(pa->k);
+}
+
+// stores the low k bits of val
+static inline void
+pa_set(struct packed_array* pa, elem_t i, uint32_t val)
+{
+    assert(i < pa->num);
+    int sh;
+    uint32_t* w = pa_locate(pa, i, &sh);
+    uint32_t mask = KBITS_MASK_32(pa->k);
+    val &= mask;
+    w[0] = (w[0] & ~(mask << sh)) | (val << sh);
+    if (sh + pa->k > 32)
+        w[8] = (w[8] & ~(mask >> (32 - sh))) | (val >> (32 - sh));
+}
+
+// num zero values of k bits each
+struct packed_array*
+pa_create(elem_t num, int k);
+
+void
+pa_destroy(struct packed_array* pa);
+
+// out[j] = value from + j for j < n
+void
+pa_unpack(struct packed_array* pa, elem_t from, elem_t n, uint32_t* out);
+
+// value from + j = low k bits of in[j] for j < n
+void
+pa_pack(struct packed_array* pa, elem_t from, const uint32_t* in, elem_t n);
+
+/**
+ * Bit i of dst = (value i <op> val), unsigned.  dst must hold at least
+ * num bits; its bits past num are cleared.
+ */
+void
+pa_compare(struct bit_vector* dst, struct packed_array* pa,
+           enum pa_cmp op, uint32_t val);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,163 @@
+/**
+ *  ring_bitmap.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "prefetch.h"
+#include "ring_bitmap.h"
+
+#define BLOCK_SHIFT 9
+
+struct ring_bitmap*
+rb_create(elem_t bit_size, int num)
+{
+    assert(num > 0);
+    struct ring_bitmap* rb = (struct ring_bitmap*) calloc(1, sizeof(*rb));
+    if (rb == NULL) return NULL;
+    rb->size = bit_size;
+    rb->blocks = ROUNDUP512(bit_size) >> BLOCK_SHIFT;
+    rb->num = num;
+    // generations 1..num, so that no zeroed stamp matches a bucket
+    rb->rot = num;
+    rb->cur = num - 1;
+
+    rb->gen = (uint32_t*) malloc(num * sizeof(uint32_t));
+    rb->stamps = (uint32_t*) calloc(rb->blocks * num, sizeof(uint32_t));
+    rb->ustamps = (uint32_t*) calloc(rb->blocks, sizeof(uint32_t));
+    rb->bvs = (struct bit_vector**) calloc(num, sizeof(struct bit_vector*));
+    rb->uni = bv_create(bit_size);
+    if (!rb->gen || !rb->stamps || !rb->ustamps || !rb->bvs || !rb->uni)
+        goto err;
+    for (int b = 0; b < num; ++b) {
+        rb->gen[b] = b + 1;
+        rb->bvs[b] = bv_create(bit_size);
+        if (rb->bvs[b] == NULL) goto err;
+    }
+    return rb;
+
+err:
+    rb_destroy(rb);
+    return NULL;
+}
+
+void
+rb_destroy(struct ring_bitmap* rb)
+{
+    if (rb->bvs) {
+        for (int b = 0; b < rb->num; ++b)
+            if (rb->bvs[b]) bv_destroy(rb->bvs[b]);
+    }
+    if (rb->uni) bv_destroy(rb->uni);
+    free(rb->bvs);
+    free(rb->ustamps);
+    free(rb->stamps);
+    free(rb->gen);
+    free(rb);
+}
+
+void
+rb_rotate(struct ring_bitmap* rb)
+{
+    rb->cur = rb->cur + 1 == rb->num ? 0 : rb->cur + 1;
+    rb->gen[rb->cur] = ++rb->rot;
+}
+
+// rebuilds the cached union of block blk
+static void
+refresh_union(struct ring_bitmap* rb, elem_t blk)
+{
+    __m256i u0 = _mm256_setzero_si256();
+    __m256i u1 = _mm256_setzero_si256();
+    const uint32_t* st = rb->stamps + blk * rb->num;
+    elem_t off = blk << 6;
+    for (int b = 0; b < rb->num; ++b) {
+        if (st[b] != rb->gen[b]) continue;
+        const uint8_t* p = rb->bvs[b]->arr + off;
+        u0 = _mm256_or_si256(u0, _mm256_load_si256((__m256i*) p));
+        u1 = _mm256_or_si256(u1, _mm256_load_si256((__m256i*) (p+32)));
+    }
+    _mm256_store_si256((__m256i*) (rb->uni->arr+off), u0);
+    _mm256_store_si256((__m256i*) (rb->uni->arr+off+32), u1);
+    rb->ustamps[blk] = rb->rot;
+}
+
+void
+rb_insert(struct ring_bitmap* rb, elem_t id)
+{
+    assert(id < rb->size);
+    elem_t blk = id >> BLOCK_SHIFT;
+    uint32_t* st = rb->stamps + blk * rb->num + rb->cur;
+    uint8_t* p = rb->bvs[rb->cur]->arr + (id >> 3);
+    uint8_t bit = 1 << (id & 7);
+    if (unlikely(*st != rb->gen[rb->cur])) {
+        // first write since the bucket was reused
+        memset(rb->bvs[rb->cur]->arr + (blk << 6), 0, 64);
+        *st = rb->gen[rb->cur];
+    }
+    *p |= bit;
+    if (rb->ustamps[blk] == rb->rot) rb->uni->arr[id >> 3] |= bit;
+}
+
+void
+rb_insert_batch(struct ring_bitmap* rb, const elem_t* ids, elem_t n)
+{
+    uint8_t* arr = rb->bvs[rb->cur]->arr;
+    for (elem_t j = 0; j < n; ++j) {
+        if (j + RB_BATCH_PREFETCH < n) {
+            elem_t ahead = ids[j + RB_BATCH_PREFETCH];
+            rte_prefetch0(arr + (ahead >> 3));
+            rte_prefetch0(rb->stamps + (ahead >> BLOCK_SHIFT) * rb->num);
+            rte_prefetch0(rb->uni->arr + (ahead >> 3));
+        }
+        rb_insert(rb, ids[j]);
+    }
+}
+
+bool
+rb_query(struct ring_bitmap* rb, elem_t id)
+{
+    assert(id < rb->size);
+    elem_t blk = id >> BLOCK_SHIFT;
+    if (rb->ustamps[blk] != rb->rot) refresh_union(rb, blk);
+    return (rb->uni->arr[id >> 3] >> (id & 7)) & 1;
+}
+
+elem_t
+rb_query_batch(struct ring_bitmap* rb, const elem_t* ids, elem_t n, bool* out)
+{
+    elem_t hits = 0;
+    for (elem_t j = 0; j < n; ++j) {
+        if (j + RB_BATCH_PREFETCH < n) {
+            elem_t ahead = ids[j + RB_BATCH_PREFETCH];
+            rte_prefetch0(rb->uni->arr + (ahead >> 3));
+            rte_prefetch0(rb->ustamps + (ahead >> BLOCK_SHIFT));
+        }
+        out[j] = rb_query(rb, ids[j]);
+        hits += out[j];
+    }
+    return hits;
+}
+
+void
+rb_union(struct ring_bitmap* rb, struct bit_vector* dst)
+{
+    assert(dst->size >= rb->size);
+    for (elem_t blk = 0; blk < rb->blocks; ++blk) {
+        if (rb->ustamps[blk] != rb->rot) refresh_union(rb, blk);
+    }
+    memcpy(dst->arr, rb->uni->arr, rb->blocks << 6);
+    memset(dst->arr + (rb->blocks << 6), 0,
+           dst->allocated - (rb->blocks << 6));
+}
@@ -0,0 +1,83 @@
+/**
+ *  ring_bitmap.h
+ *
+ *  Sliding-window membership over a ring of time buckets: ids go into
+ *  the current bucket, a query asks whether an id was inserted into any
+ *  of the last B buckets, and rotating drops the oldest bucket.
+ *
+ *  Rotation is O(1).  Every 64-byte block of a bucket carries the
+ *  generation it was last written in, so a reused bucket is cleared a
+ *  block at a time on first write instead of by a full memset.  The
+ *  union of the live buckets is cached per block and rebuilt lazily on
+ *  the first query after a rotation; inserts keep valid blocks current.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef RING_BITMAP_H
+#define RING_BITMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ids looked ahead by the batched insert and query
+#define RB_BATCH_PREFETCH 8
+
+struct ring_bitmap {
+    // bits per bucket
+    elem_t size;
+    // 64-byte blocks per bucket
+    elem_t blocks;
+    int num;
+    // bucket receiving inserts
+    int cur;
+    // rotations so far; wraps after 2^32, far beyond any window
+    uint32_t rot;
+    // generation of each bucket, the rotation that made it current
+    uint32_t* gen;
+    // stamps[blk * num + b]: generation block blk of bucket b was written in
+    uint32_t* stamps;
+    // ustamps[blk]: rotation the cached union block was built in
+    uint32_t* ustamps;
+    struct bit_vector* uni;
+    struct bit_vector** bvs;
+};
+
+// num buckets of bit_size bits each, all empty
+struct ring_bitmap*
+rb_create(elem_t bit_size, int num);
+
+void
+rb_destroy(struct ring_bitmap* rb);
+
+// expires the oldest bucket and makes it the current one, O(1)
+void
+rb_rotate(struct ring_bitmap* rb);
+
+void
+rb_insert(struct ring_bitmap* rb, elem_t id);
+
+void
+rb_insert_batch(struct ring_bitmap* rb, const elem_t* ids, elem_t n);
+
+// was id inserted during the window
+bool
+rb_query(struct ring_bitmap* rb, elem_t id);
+
+// out[j] = rb_query(ids[j]); returns the number of hits
+elem_t
+rb_query_batch(struct ring_bitmap* rb, const elem_t* ids, elem_t n, bool* out);
+
+// dst = union of the live buckets; dst must hold at least size bits
+void
+rb_union(struct ring_bitmap* rb, struct bit_vector* dst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
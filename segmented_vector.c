@@ -0,0 +1,232 @@
+/**
+ *  segmented_vector.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "segmented_vector.h"
+
+#define same_shape(a, b) \
+    assert((a)->size == (b)->size && (a)->shift == (b)->shift)
+
+// grows the segment directory; only pointers are copied
+static bool
+reserve(struct seg_vector* sv, elem_t num)
+{
+    if (num <= sv->cap) return true;
+    elem_t cap = sv->cap ? sv->cap : 4;
+    while (cap < num) cap <<= 1;
+    struct bit_vector** segs =
+        (struct bit_vector**) realloc(sv->segs, cap * sizeof(*segs));
+    if (segs == NULL) return false;
+    sv->segs = segs;
+    sv->cap = cap;
+    return true;
+}
+
+/**
+ * Bytes of a segment with live bits in use.  Segments are allocated
+ * uninitialised and only this prefix is zeroed and exposed through
+ * allocated, so growing bit by bit zeroes each byte about once.  It is
+ * a power of two, which never exceeds the segment, and depends on live
+ * alone, so vectors of one size have segments of one shape.
+ */
+static elem_t
+live_bytes(elem_t live)
+{
+    elem_t need = ROUNDUP8(live) >> 3, bytes = 256;
+    while (bytes < need) bytes <<= 1;
+    return bytes;
+}
+
+static struct bit_vector*
+segment_alloc(struct seg_vector* sv)
+{
+    void* p;
+    size_t msize = sizeof(struct bit_vector) + (sg_segment_bits(sv) >> 3);
+    if (posix_memalign(&p, 64, msize)) return NULL;
+    struct bit_vector* seg = (struct bit_vector*) p;
+    seg->allocated = 0;
+    seg->size = 0;
+    return seg;
+}
+
+// extends seg to live bits, zeroing only the bytes it newly exposes
+static void
+segment_grow(struct bit_vector* seg, elem_t live)
+{
+    elem_t bytes = live_bytes(live);
+    if (bytes > seg->allocated) {
+        memset(seg->arr + seg->allocated, 0, bytes - seg->allocated);
+        seg->allocated = bytes;
+    }
+    seg->size = live;
+}
+
+// zeroes the bits of the last segment past size
+static void
+clear_tail(struct seg_vector* sv)
+{
+    elem_t off = sv->size & (sg_segment_bits(sv) - 1);
+    if (off == 0) return;
+    struct bit_vector* seg = sv->segs[sv->num - 1];
+    elem_t byte = off >> 3;
+    if (off & 7) seg->arr[byte++] &= (1 << (off & 7)) - 1;
+    memset(seg->arr + byte, 0, seg->allocated - byte);
+}
+
+struct seg_vector*
+sg_create(elem_t bit_size, int shift)
+{
+    if (shift == 0) shift = SG_DEFAULT_SHIFT;
+    if (shift < SG_MIN_SHIFT || shift > SG_MAX_SHIFT) return NULL;
+    struct seg_vector* sv = (struct seg_vector*) calloc(1, sizeof(*sv));
+    if (sv == NULL) return NULL;
+    sv->shift = shift;
+    if (!sg_resize(sv, bit_size)) {
+        sg_destroy(sv);
+        return NULL;
+    }
+    return sv;
+}
+
+void
+sg_destroy(struct seg_vector* sv)
+{
+    for (elem_t k = 0; k < sv->num; ++k)
+        bv_destroy(sv->segs[k]);
+    free(sv->segs);
+    free(sv);
+}
+
+bool
+sg_resize(struct seg_vector* sv, elem_t bit_size)
+{
+    elem_t bits = sg_segment_bits(sv);
+    elem_t num = (bit_size + bits - 1) >> sv->shift;
+    if (bit_size <= sv->size) {
+        for (elem_t k = num; k < sv->num; ++k)
+            bv_destroy(sv->segs[k]);
+        sv->num = num;
+        sv->size = bit_size;
+        if (num == 0) return true;
+        clear_tail(sv);
+        struct bit_vector* seg = sv->segs[num - 1];
+        seg->size = bit_size - ((num - 1) << sv->shift);
+        seg->allocated = live_bytes(seg->size);
+        return true;
+    }
+
+    if (!reserve(sv, num)) return false;
+    for (elem_t k = sv->num; k < num; ++k) {
+        sv->segs[k] = segment_alloc(sv);
+        if (sv->segs[k] == NULL) {
+            for (elem_t j = sv->num; j < k; ++j)
+                bv_destroy(sv->segs[j]);
+            return false;
+        }
+    }
+    // the old last segment and the new ones cover more live bits now
+    for (elem_t k = sv->num ? sv->num - 1 : 0; k < num; ++k) {
+        elem_t live = bit_size - (k << sv->shift);
+        if (live > bits) live = bits;
+        segment_grow(sv->segs[k], live);
+    }
+    sv->num = num;
+    sv->size = bit_size;
+    return true;
+}
+
+bool
+sg_push(struct seg_vector* sv, bool val)
+{
+    if (!sg_resize(sv, sv->size + 1)) return false;
+    sg_set(sv, sv->size - 1, val);
+    return true;
+}
+
+void
+sg_not(struct seg_vector* dst, struct seg_vector* sv)
+{
+    same_shape(dst, sv);
+    for (elem_t k = 0; k < dst->num; ++k)
+        bv_not_with_dst(dst->segs[k], sv->segs[k]);
+    clear_tail(dst);
+}
+
+void
+sg_and(struct seg_vector* dst, struct seg_vector* sv1, struct seg_vector* sv2)
+{
+    same_shape(dst, sv1);
+    same_shape(dst, sv2);
+    for (elem_t k = 0; k < dst->num; ++k)
+        bv_and_with_dst_256(dst->segs[k], sv1->segs[k], sv2->segs[k]);
+}
+
+void
+sg_or(struct seg_vector* dst, struct seg_vector* sv1, struct seg_vector* sv2)
+{
+    same_shape(dst, sv1);
+    same_shape(dst, sv2);
+    for (elem_t k = 0; k < dst->num; ++k)
+        bv_or_with_dst(dst->segs[k], sv1->segs[k], sv2->segs[k]);
+}
+
+void
+sg_xor(struct seg_vector* dst, struct seg_vector* sv1, struct seg_vector* sv2)
+{
+    same_shape(dst, sv1);
+    same_shape(dst, sv2);
+    for (elem_t k = 0; k < dst->num; ++k)
+        bv_xor_with_dst(dst->segs[k], sv1->segs[k], sv2->segs[k]);
+}
+
+void
+sg_multiple_and(struct seg_vector* dst, struct seg_vector** svs, int sv_num)
+{
+    assert(sv_num > 0);
+    for (int i = 0; i < sv_num; ++i)
+        same_shape(dst, svs[i]);
+    struct bit_vector* bvs[sv_num];
+    for (elem_t k = 0; k < dst->num; ++k) {
+        for (int i = 0; i < sv_num; ++i)
+            bvs[i] = svs[i]->segs[k];
+        bv_multiple_and_256(dst->segs[k], bvs, sv_num);
+    }
+}
+
+elem_t
+sg_popcount(struct seg_vector* sv)
+{
+    elem_t n = 0;
+    for (elem_t k = 0; k < sv->num; ++k)
+        n += bv_popcount(sv->segs[k]);
+    return n;
+}
+
+int64_t
+sg_ffs(struct seg_vector* sv)
+{
+    return sg_find_next(sv, 0);
+}
+
+int64_t
+sg_find_next(struct seg_vector* sv, elem_t from)
+{
+    if (from >= sv->size) return -1;
+    elem_t k = from >> sv->shift;
+    int64_t pos = bv_find_next(sv->segs[k], from & (sg_segment_bits(sv) - 1));
+    while (pos < 0 && ++k < sv->num)
+        pos = bv_ffs(sv->segs[k]);
+    return pos < 0 ? -1 : (int64_t) ((k << sv->shift) + pos);
+}
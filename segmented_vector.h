@@ -0,0 +1,130 @@
+/**
+ *  segmented_vector.h
+ *
+ *  Bit vectors of many gigabits built from fixed-size segments, each an
+ *  ordinary bit_vector allocated on its own.  No single allocation ever
+ *  spans the whole vector, growing only appends segments (the directory
+ *  of segment pointers is the only thing ever reallocated), and bulk ops
+ *  run the bit_vector kernels segment by segment without copying.
+ *
+ *  All indices are 64-bit.  Bits past size are kept zero, as in
+ *  bit_vector.  The last segment's size and allocated cover only its
+ *  live bits, rounded up to a power of two bytes; the rest of its
+ *  memory is zeroed as the vector grows into it.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef SEGMENTED_VECTOR_H
+#define SEGMENTED_VECTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// segments hold 2^shift bits; 2^30 bits are 128 MiB
+#define SG_DEFAULT_SHIFT 30
+// a segment is at least one 256-byte bit_vector allocation unit
+#define SG_MIN_SHIFT 11
+#define SG_MAX_SHIFT 40
+
+struct seg_vector {
+    // bit length
+    elem_t size;
+    int shift;
+    // segments in use and directory capacity
+    elem_t num;
+    elem_t cap;
+    struct bit_vector** segs;
+};
+
+static inline elem_t
+sg_segment_bits(struct seg_vector* sv)
+{
+    return (elem_t) 1 << sv->shift;
+}
+
+// segment k, holding bits [k << shift, (k + 1) << shift)
+static inline struct bit_vector*
+sg_segment(struct seg_vector* sv, elem_t k)
+{
+    assert(k < sv->num);
+    return sv->segs[k];
+}
+
+// shift 0 picks SG_DEFAULT_SHIFT
+struct seg_vector*
+sg_create(elem_t bit_size, int shift);
+
+void
+sg_destroy(struct seg_vector* sv);
+
+/**
+ * Grows by appending segments or shrinks by freeing trailing ones;
+ * existing segments never move.  Returns false, leaving the
+ * vector as it was, if a segment could not be allocated.
+ */
+bool
+sg_resize(struct seg_vector* sv, elem_t bit_size);
+
+// appends one bit, amortized O(1)
+bool
+sg_push(struct seg_vector* sv, bool val);
+
+static inline void
+sg_set(struct seg_vector* sv, elem_t index, bool val)
+{
+    assert(index < sv->size);
+    uint8_t* p = sv->segs[index >> sv->shift]->arr +
+                 ((index & (sg_segment_bits(sv) - 1)) >> 3);
+    *p = (*p & ~(1 << (index & 7))) | (val << (index & 7));
+}
+
+static inline bool
+sg_value(struct seg_vector* sv, elem_t index)
+{
+    assert(index < sv->size);
+    const uint8_t* p = sv->segs[index >> sv->shift]->arr +
+                       ((index & (sg_segment_bits(sv) - 1)) >> 3);
+    return (*p >> (index & 7)) & 1;
+}
+
+/**
+ * Bulk ops.  Operands and dst must have the same size and segment
+ * shift; dst may be one of the operands.
+ */
+void
+sg_not(struct seg_vector* dst, struct seg_vector* sv);
+
+void
+sg_and(struct seg_vector* dst, struct seg_vector* sv1, struct seg_vector* sv2);
+
+void
+sg_or(struct seg_vector* dst, struct seg_vector* sv1, struct seg_vector* sv2);
+
+void
+sg_xor(struct seg_vector* dst, struct seg_vector* sv1, struct seg_vector* sv2);
+
+void
+sg_multiple_and(struct seg_vector* dst, struct seg_vector** svs, int sv_num);
+
+elem_t
+sg_popcount(struct seg_vector* sv);
+
+// first set bit, -1 if none
+int64_t
+sg_ffs(struct seg_vector* sv);
+
+// first set bit at or after from, -1 if none
+int64_t
+sg_find_next(struct seg_vector* sv, elem_t from);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+/**
+ *  simd_utils.h
+ *
+ *  Small SIMD helpers shared by the kernels.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef SIMD_UTILS_H
+#define SIMD_UTILS_H
+
+#include <stdint.h>
+#include <immintrin.h>
+
+/**
+ * Popcount of each 64-bit lane (Mula's nibble lookup): vpshufb counts
+ * the bits of every nibble, vpsadbw sums the bytes of each lane.
+ */
+static inline __m256i
+popcount_epi64_256(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                  _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+static inline uint64_t
+hsum_epi64_256(__m256i v)
+{
+    __m128i s = _mm_add_epi64(_mm256_castsi256_si128(v),
+                              _mm256_extracti128_si256(v, 1));
+    return (uint64_t) _mm_cvtsi128_si64(s) +
+           (uint64_t) _mm_extract_epi64(s, 1);
+}
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ *  similarity.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "simd_utils.h"
+#include "similarity.h"
+
+enum pop_op {
+    POP_AND,
+    POP_XOR,
+};
+
+/**
+ * popcount(a op b) over the first nbits bits.  Whole 256-bit blocks go
+ * through the vpshufb popcount with per-lane accumulators, the tail is
+ * handled a word at a time.
+ */
+static inline elem_t
+popcount_op(const uint8_t* a, const uint8_t* b, elem_t nbits, enum pop_op op)
+{
+    elem_t blocks = nbits >> 8;
+    __m256i acc = _mm256_setzero_si256();
+    for (elem_t i = 0; i < blocks; ++i) {
+        __m256i va = _mm256_load_si256((__m256i*) (a + (i << 5)));
+        __m256i vb = _mm256_load_si256((__m256i*) (b + (i << 5)));
+        __m256i v = op == POP_AND ? _mm256_and_si256(va, vb)
+                                  : _mm256_xor_si256(va, vb);
+        acc = _mm256_add_epi64(acc, popcount_epi64_256(v));
+    }
+    elem_t res = hsum_epi64_256(acc);
+
+    const uint64_t* wa = (const uint64_t*) a;
+    const uint64_t* wb = (const uint64_t*) b;
+    for (elem_t w = blocks << 2; (w << 6) < nbits; ++w) {
+        uint64_t v = op == POP_AND ? wa[w] & wb[w] : wa[w] ^ wb[w];
+        if (((w + 1) << 6) > nbits)
+            v &= (1ULL << (nbits & 63)) - 1;
+        res += popcountll(v);
+    }
+    return res;
+}
+
+elem_t
+bv_hamming(struct bit_vector* bv1, struct bit_vector* bv2)
+{
+    elem_t nbits = min(bv1->size, bv2->size);
+    return popcount_op(bv1->arr, bv2->arr, nbits, POP_XOR);
+}
+
+double
+bv_jaccard(struct bit_vector* bv1, struct bit_vector* bv2)
+{
+    elem_t nbits = min(bv1->size, bv2->size);
+    elem_t inter = popcount_op(bv1->arr, bv2->arr, nbits, POP_AND);
+    elem_t diff = popcount_op(bv1->arr, bv2->arr, nbits, POP_XOR);
+    // |a | b| = |a & b| + |a ^ b|
+    if (inter + diff == 0) return 1.0;
+    return (double) inter / (double) (inter + diff);
+}
+
+/**
+ * Only |a & b| is computed per pair; with the per-vector popcounts
+ *   hamming = |a| + |b| - 2|a & b|,  union = |a| + |b| - |a & b|.
+ */
+struct pairwise_job {
+    struct bit_vector** bvs;
+    int n;
+    int tile;
+    int tiles;
+    elem_t* popcounts;
+    elem_t* hamming;
+    double* jaccard;
+    // next tile pair to hand out, in row-major order over the upper triangle
+    volatile int next;
+};
+
+static void
+pairwise_tile(struct pairwise_job* job, int ti, int tj)
+{
+    int n = job->n, tile = job->tile;
+    elem_t nbits = job->bvs[0]->size;
+    int i_end = min((ti + 1) * tile, n);
+    int j_end = min((tj + 1) * tile, n);
+    for (int i = ti * tile; i < i_end; ++i) {
+        const uint8_t* a = job->bvs[i]->arr;
+        int j = ti == tj ? i : tj * tile;
+        for (; j < j_end; ++j) {
+            elem_t pa = job->popcounts[i], pb = job->popcounts[j];
+            elem_t inter = i == j ? pa
+                : popcount_op(a, job->bvs[j]->arr, nbits, POP_AND);
+            if (job->hamming) {
+                elem_t d = pa + pb - 2 * inter;
+                job->hamming[(elem_t) i * n + j] = d;
+                job->hamming[(elem_t) j * n + i] = d;
+            } else {
+                elem_t uni = pa + pb - inter;
+                double d = uni ? 1.0 - (double) inter / (double) uni : 0.0;
+                job->jaccard[(elem_t) i * n + j] = d;
+                job->jaccard[(elem_t) j * n + i] = d;
+            }
+        }
+    }
+}
+
+static void*
+pairwise_worker(void* arg)
+{
+    struct pairwise_job* job = (struct pairwise_job*) arg;
+    int tiles = job->tiles;
+    int total = tiles * (tiles + 1) / 2;
+    for (;;) {
+        int k = __sync_fetch_and_add(&job->next, 1);
+        if (k >= total) break;
+        // k-th (ti, tj) with ti <= tj
+        int ti = 0;
+        while (k >= tiles - ti) {
+            k -= tiles - ti;
+            ti++;
+        }
+        pairwise_tile(job, ti, ti + k);
+    }
+    return NULL;
+}
+
+static bool
+pairwise_run(struct bit_vector** bvs, int n, elem_t* hamming,
+             double* jaccard, int threads)
+{
+    if (n <= 0) return true;
+    for (int i = 1; i < n; ++i)
+        assert(bvs[i]->size == bvs[0]->size);
+
+    struct pairwise_job job;
+    memset(&job, 0, sizeof(job));
+    job.bvs = bvs;
+    job.n = n;
+    job.hamming = hamming;
+    job.jaccard = jaccard;
+    job.popcounts = (elem_t*) malloc(sizeof(elem_t) * n);
+    if (job.popcounts == NULL) return false;
+    for (int i = 0; i < n; ++i)
+        job.popcounts[i] = bv_popcount(bvs[i]);
+
+    // two tiles of vectors should fit in half of L2
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (l2 <= 0) l2 = 256 << 10;
+    // empty vectors take no space, any tile size will do
+    elem_t bytes = bvs[0]->allocated ? bvs[0]->allocated : 1;
+    job.tile = max(1, (int) ((elem_t) l2 / 4 / bytes));
+    job.tiles = (n + job.tile - 1) / job.tile;
+
+    // more threads than cores or tile pairs only adds contention, and
+    // the clamp keeps tids small whatever the caller passes
+    int ncpu = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu <= 0) ncpu = 1;
+    if (threads <= 0 || threads > ncpu) threads = ncpu;
+    int units = job.tiles * (job.tiles + 1) / 2;
+    if (threads > units) threads = units;
+    pthread_t tids[threads];
+    int started = 0;
+    for (; started < threads - 1; ++started) {
+        if (pthread_create(&tids[started], NULL, pairwise_worker, &job))
+            break;
+    }
+    // the calling thread takes part too, so a failed create only slows down
+    pairwise_worker(&job);
+    for (int i = 0; i < started; ++i)
+        pthread_join(tids[i], NULL);
+
+    free(job.popcounts);
+    return true;
+}
+
+bool
+bv_pairwise_distance(struct bit_vector** bvs, int n, elem_t* out_matrix,
+                     int threads)
+{
+    return pairwise_run(bvs, n, out_matrix, NULL, threads);
+}
+
+bool
+bv_pairwise_jaccard(struct bit_vector** bvs, int n, double* out_matrix,
+                    int threads)
+{
+    return pairwise_run(bvs, n, NULL, out_matrix, threads);
+}
@@ -0,0 +1,48 @@
+/**
+ *  similarity.h
+ *
+ *  Hamming / Jaccard similarity between bit vectors and all-pairs
+ *  distance matrices.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef SIMILARITY_H
+#define SIMILARITY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// number of differing bits over the first min(bv1->size, bv2->size) bits
+elem_t
+bv_hamming(struct bit_vector* bv1, struct bit_vector* bv2);
+
+// |bv1 & bv2| / |bv1 | bv2|, 1.0 when both are empty
+double
+bv_jaccard(struct bit_vector* bv1, struct bit_vector* bv2);
+
+/**
+ * Fills the n x n row-major matrix out with the Hamming distance of every
+ * pair.  All vectors must have the same size.  The matrix is computed in
+ * tiles sized to stay in L2 and the tiles are spread over threads worker
+ * threads (0 picks the number of online CPUs).  Returns false if memory
+ * for the per-vector popcounts could not be allocated.
+ */
+bool
+bv_pairwise_distance(struct bit_vector** bvs, int n, elem_t* out_matrix,
+                     int threads);
+
+// same, with Jaccard distances (1 - bv_jaccard())
+bool
+bv_pairwise_jaccard(struct bit_vector** bvs, int n, double* out_matrix,
+                    int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
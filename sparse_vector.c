@@ -0,0 +1,332 @@
+/**
+ *  sparse_vector.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "sparse_vector.h"
+
+#define sv_malloc malloc
+#define sv_free free
+
+// switch from SIMD block merge to galloping above this length ratio
+#define GALLOP_RATIO 64
+
+struct sparse_vector*
+sv_create(elem_t bit_size, elem_t capacity)
+{
+    assert(bit_size <= (elem_t) UINT32_MAX + 1);
+    struct sparse_vector *sv;
+    size_t msize = sizeof(struct sparse_vector) +
+                   sizeof(uint32_t) * capacity;
+    sv = (struct sparse_vector *) sv_malloc(msize);
+    if (sv == NULL) return NULL;
+
+    sv->allocated = capacity;
+    sv->size = bit_size;
+    sv->count = 0;
+    return sv;
+}
+
+void
+sv_destroy(struct sparse_vector* sv)
+{
+    sv_free(sv);
+}
+
+bool
+sv_append(struct sparse_vector* sv, uint32_t index)
+{
+    assert(index < sv->size);
+    assert(sv->count == 0 || sv->idx[sv->count - 1] < index);
+    if (unlikely(sv->count == sv->allocated)) return false;
+    sv->idx[sv->count++] = index;
+    return true;
+}
+
+/**
+ * first position in [lo, n) whose value is >= key: exponential probe
+ * from lo, then binary search inside the last step.
+ */
+static inline elem_t
+gallop(const uint32_t* arr, elem_t lo, elem_t n, uint32_t key)
+{
+    elem_t hi = lo, step = 1;
+    while (hi < n && arr[hi] < key) {
+        lo = hi + 1;
+        hi += step;
+        step <<= 1;
+    }
+    if (hi > n) hi = n;
+    while (lo < hi) {
+        elem_t mid = (lo + hi) >> 1;
+        if (arr[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+bool
+sv_value(struct sparse_vector* sv, elem_t index)
+{
+    assert(index < sv->size);
+    elem_t pos = gallop(sv->idx, 0, sv->count, (uint32_t) index);
+    return pos < sv->count && sv->idx[pos] == index;
+}
+
+struct sparse_vector*
+sv_from_bv(struct bit_vector* bv)
+{
+    struct sparse_vector* sv = sv_create(bv->size, bv_popcount(bv));
+    if (sv == NULL) return NULL;
+
+    uint64_t *arr = (uint64_t*) bv->arr;
+    elem_t words = ROUNDUP64(bv->size) >> 6;
+    elem_t count = 0;
+    for (elem_t i = 0; i < words; i++) {
+        uint64_t cur = arr[i];
+        while (cur) {
+            uint32_t pos = (i << 6) + __builtin_ctzll(cur);
+            if (pos >= bv->size) break;
+            sv->idx[count++] = pos;
+            cur &= cur - 1;
+        }
+    }
+    sv->count = count;
+    return sv;
+}
+
+struct bit_vector*
+sv_to_bv(struct sparse_vector* sv)
+{
+    struct bit_vector* bv = bv_create(sv->size);
+    if (bv == NULL) return NULL;
+
+    uint8_t *arr = bv->arr;
+    for (elem_t i = 0; i < sv->count; i++) {
+        uint32_t pos = sv->idx[i];
+        arr[pos >> 3] |= 1 << (pos & 7);
+    }
+    return bv;
+}
+
+static elem_t
+intersect_galloping(uint32_t* out,
+                    const uint32_t* small, elem_t ns,
+                    const uint32_t* large, elem_t nl)
+{
+    elem_t count = 0, j = 0;
+    for (elem_t i = 0; i < ns; i++) {
+        uint32_t key = small[i];
+        j = gallop(large, j, nl, key);
+        if (j == nl) break;
+        if (large[j] == key) out[count++] = key;
+    }
+    return count;
+}
+
+/**
+ * Skips the larger list 8 entries at a time and compares each key of the
+ * smaller list against a whole block with one vpcmpeqd.
+ */
+static elem_t
+intersect_simd(uint32_t* out,
+               const uint32_t* small, elem_t ns,
+               const uint32_t* large, elem_t nl)
+{
+    elem_t count = 0, j = 0;
+    for (elem_t i = 0; i < ns; i++) {
+        uint32_t key = small[i];
+        while (j + 8 <= nl && large[j + 7] < key) j += 8;
+        if (j + 8 <= nl) {
+            __m256i blk = _mm256_loadu_si256((__m256i*) (large + j));
+            __m256i cmp = _mm256_cmpeq_epi32(blk, _mm256_set1_epi32(key));
+            if (_mm256_movemask_epi8(cmp)) out[count++] = key;
+            continue;
+        }
+        while (j < nl && large[j] < key) j++;
+        if (j == nl) break;
+        if (large[j] == key) out[count++] = key;
+    }
+    return count;
+}
+
+// out may alias small, the write index never passes the read index
+static elem_t
+intersect(uint32_t* out,
+          const uint32_t* small, elem_t ns,
+          const uint32_t* large, elem_t nl)
+{
+    if (ns == 0 || nl == 0) return 0;
+    if (nl / ns >= GALLOP_RATIO)
+        return intersect_galloping(out, small, ns, large, nl);
+    return intersect_simd(out, small, ns, large, nl);
+}
+
+// keeps only the positions whose bit is set in bv, in place
+static elem_t
+filter_dense(uint32_t* idx, elem_t n, struct bit_vector* bv)
+{
+    uint8_t *arr = bv->arr;
+    elem_t count = 0;
+    for (elem_t i = 0; i < n; i++) {
+        uint32_t pos = idx[i];
+        idx[count] = pos;
+        count += (arr[pos >> 3] >> (pos & 7)) & 1;
+    }
+    return count;
+}
+
+struct sparse_vector*
+sv_and(struct sparse_vector* sv1, struct sparse_vector* sv2)
+{
+    if (sv1->count > sv2->count) {
+        struct sparse_vector* tmp = sv1;
+        sv1 = sv2;
+        sv2 = tmp;
+    }
+    elem_t bit_size = min(sv1->size, sv2->size);
+    struct sparse_vector* sv3 = sv_create(bit_size, sv1->count);
+    if (sv3 == NULL) return NULL;
+
+    sv3->count = intersect(sv3->idx, sv1->idx, sv1->count,
+                           sv2->idx, sv2->count);
+    while (sv3->count && sv3->idx[sv3->count - 1] >= bit_size)
+        sv3->count--;
+    return sv3;
+}
+
+struct sparse_vector*
+sv_and_bv(struct sparse_vector* sv, struct bit_vector* bv)
+{
+    elem_t bit_size = min(sv->size, bv->size);
+    struct sparse_vector* res = sv_create(bit_size, sv->count);
+    if (res == NULL) return NULL;
+
+    elem_t n = sv->count;
+    while (n && sv->idx[n - 1] >= bit_size) n--;
+    memcpy(res->idx, sv->idx, sizeof(uint32_t) * n);
+    res->count = filter_dense(res->idx, n, bv);
+    return res;
+}
+
+bool
+av_init(struct adaptive_vector* av, struct bit_vector* bv)
+{
+    av->repr = BV_DENSE;
+    av->dense = bv;
+    return av_optimize(av);
+}
+
+bool
+av_optimize(struct adaptive_vector* av)
+{
+    if (av->repr == BV_DENSE) {
+        struct bit_vector* bv = av->dense;
+        if (bv->size > (elem_t) UINT32_MAX + 1 ||
+            bv_popcount(bv) * SPARSE_RATIO >= bv->size)
+            return true;
+
+        struct sparse_vector* sv = sv_from_bv(bv);
+        if (sv == NULL) return false;
+        bv_destroy(bv);
+        av->repr = BV_SPARSE;
+        av->sparse = sv;
+    } else {
+        // only go back to dense well past the threshold to avoid flapping
+        struct sparse_vector* sv = av->sparse;
+        if (sv->count * SPARSE_RATIO < sv->size * 2)
+            return true;
+
+        struct bit_vector* bv = sv_to_bv(sv);
+        if (bv == NULL) return false;
+        sv_destroy(sv);
+        av->repr = BV_DENSE;
+        av->dense = bv;
+    }
+    return true;
+}
+
+void
+av_destroy(struct adaptive_vector* av)
+{
+    if (av->repr == BV_DENSE) bv_destroy(av->dense);
+    else sv_destroy(av->sparse);
+    av->dense = NULL;
+}
+
+elem_t
+av_size(struct adaptive_vector* av)
+{
+    return av->repr == BV_DENSE ? av->dense->size : av->sparse->size;
+}
+
+static int
+cmp_sparse_count(const void* a, const void* b)
+{
+    const struct adaptive_vector* x = *(struct adaptive_vector* const*) a;
+    const struct adaptive_vector* y = *(struct adaptive_vector* const*) b;
+    if (x->repr != y->repr) return x->repr == BV_SPARSE ? -1 : 1;
+    if (x->repr == BV_DENSE) return 0;
+    return (x->sparse->count > y->sparse->count) -
+           (x->sparse->count < y->sparse->count);
+}
+
+bool
+av_multiple_and(struct adaptive_vector* dst,
+                struct adaptive_vector** avs, int num)
+{
+    assert(num > 0);
+    elem_t bit_size = av_size(avs[0]);
+    for (int i = 1; i < num; ++i) {
+        elem_t size = av_size(avs[i]);
+        bit_size = min(bit_size, size);
+    }
+
+    // sparse operands first, sparsest at the head
+    struct adaptive_vector* ops[num];
+    memcpy(ops, avs, sizeof(ops[0]) * num);
+    qsort(ops, num, sizeof(ops[0]), cmp_sparse_count);
+
+    if (ops[0]->repr == BV_DENSE) {
+        struct bit_vector* bvs[num];
+        for (int i = 0; i < num; ++i) bvs[i] = ops[i]->dense;
+        struct bit_vector* bv = bv_create(bit_size);
+        if (bv == NULL) return false;
+        bv_multiple_and_256(bv, bvs, num);
+        dst->repr = BV_DENSE;
+        dst->dense = bv;
+        return true;
+    }
+
+    struct sparse_vector* head = ops[0]->sparse;
+    struct sparse_vector* sv = sv_create(bit_size, head->count);
+    if (sv == NULL) return false;
+
+    elem_t n = head->count;
+    while (n && head->idx[n - 1] >= bit_size) n--;
+    memcpy(sv->idx, head->idx, sizeof(uint32_t) * n);
+    for (int i = 1; i < num && n; ++i) {
+        if (ops[i]->repr == BV_SPARSE) {
+            struct sparse_vector* cur = ops[i]->sparse;
+            n = intersect(sv->idx, sv->idx, n, cur->idx, cur->count);
+        } else {
+            n = filter_dense(sv->idx, n, ops[i]->dense);
+        }
+    }
+    sv->count = n;
+    dst->repr = BV_SPARSE;
+    dst->sparse = sv;
+    return true;
+}
@@ -0,0 +1,110 @@
+/**
+ *  sparse_vector.h
+ *
+ *  Sorted index representation for bit vectors with few set bits, and an
+ *  adaptive wrapper that picks between it and struct bit_vector.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef SPARSE_VECTOR_H
+#define SPARSE_VECTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * A vector is kept sparse while popcount * SPARSE_RATIO < size, i.e. the
+ * index array is smaller than the dense body (32 bits per set bit against
+ * 1 bit per position) with some slack to avoid flapping.
+ */
+#ifndef SPARSE_RATIO
+#define SPARSE_RATIO 64
+#endif
+
+struct sparse_vector {
+    // allocated index slots
+    elem_t allocated;
+    // available bit length
+    elem_t size;
+    // number of set bits, i.e. used index slots
+    elem_t count;
+
+    // set bit positions in ascending order
+    uint32_t idx[0];
+};
+
+enum bv_repr {
+    BV_DENSE,
+    BV_SPARSE,
+};
+
+struct adaptive_vector {
+    enum bv_repr repr;
+    union {
+        struct bit_vector* dense;
+        struct sparse_vector* sparse;
+    };
+};
+
+struct sparse_vector*
+sv_create(elem_t bit_size, elem_t capacity);
+
+void
+sv_destroy(struct sparse_vector* sv);
+
+// appends a position larger than any already stored
+bool
+sv_append(struct sparse_vector* sv, uint32_t index);
+
+bool
+sv_value(struct sparse_vector* sv, elem_t index);
+
+struct sparse_vector*
+sv_from_bv(struct bit_vector* bv);
+
+struct bit_vector*
+sv_to_bv(struct sparse_vector* sv);
+
+struct sparse_vector*
+sv_and(struct sparse_vector* sv1, struct sparse_vector* sv2);
+
+struct sparse_vector*
+sv_and_bv(struct sparse_vector* sv, struct bit_vector* bv);
+
+/**
+ * Takes ownership of bv and stores it in whichever representation the
+ * density calls for.  Returns false if the conversion failed, in which
+ * case av keeps bv as is.
+ */
+bool
+av_init(struct adaptive_vector* av, struct bit_vector* bv);
+
+// re-evaluates the density and converts in place if needed
+bool
+av_optimize(struct adaptive_vector* av);
+
+void
+av_destroy(struct adaptive_vector* av);
+
+elem_t
+av_size(struct adaptive_vector* av);
+
+/**
+ * Intersection of num mixed-representation operands.  If any operand is
+ * sparse the result is sparse and the work is proportional to the
+ * sparsest operand; otherwise it falls back to bv_multiple_and_256().
+ */
+bool
+av_multiple_and(struct adaptive_vector* dst,
+                struct adaptive_vector** avs, int num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,13 +6,31 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include "common.h"
 #include "bit_utils.h"
 #include "bitvector.h"
+#include "sparse_vector.h"
+#include "file_vector.h"
+#include "similarity.h"
+#include "bloom_filter.h"
+#include "lookup_service.h"
+#include "vector_bank.h"
+#include "bitmap_index.h"
+#include "bit_view.h"
+#include "threshold.h"
+#include "bit_matrix.h"
+#include "bv_stats.h"
+#include "segmented_vector.h"
+#include "packed_array.h"
+#include "ring_bitmap.h"
+#include "bitap.h"
 
 void
 macro_test()
@@ -36,10 +54,1182 @@ macro_test()
     assert(ROUNDUP128(129) == 256);
 }
 
+static inline bool
+bit(struct bit_vector* bv, elem_t i)
+{
+    return (bv->arr[i >> 3] >> (i & 7)) & 1;
+}
+
+void
+sparse_test()
+{
+    int size = 100000;
+    struct bit_vector* dense = bv_create(size);
+    struct bit_vector* mid = bv_create(size);
+    struct bit_vector* few = bv_create(size);
+    struct bit_vector* rare = bv_create(size);
+    assert(dense && mid && few && rare);
+    for (int i = 0; i < size; ++i) {
+        if (i % 2 == 0) bv_set(dense, i, true);
+        if (i % 3 == 0) bv_set(mid, i, true);
+        if (i % 70 == 0) bv_set(few, i, true);
+        if (i % 9100 == 0) bv_set(rare, i, true);
+    }
+
+    struct sparse_vector* sv = sv_from_bv(few);
+    assert(sv->count == bv_popcount(few));
+    for (int i = 0; i < size; ++i)
+        assert(sv_value(sv, i) == bit(few, i));
+    struct bit_vector* back = sv_to_bv(sv);
+    assert(memcmp(back->arr, few->arr, few->allocated) == 0);
+    bv_destroy(back);
+
+    struct sparse_vector* sr = sv_from_bv(rare);
+    struct sparse_vector* s1 = sv_and(sv, sr);
+    struct sparse_vector* s2 = sv_and_bv(sv, mid);
+    for (int i = 0; i < size; ++i) {
+        assert(sv_value(s1, i) == (i % 9100 == 0));
+        assert(sv_value(s2, i) == (i % 210 == 0));
+    }
+    sv_destroy(s1);
+    sv_destroy(s2);
+
+    struct sparse_vector* s50 = sv_create(size, size / 50);
+    for (int i = 0; i < size; i += 50) assert(sv_append(s50, i));
+    s1 = sv_and(s50, sv);
+    for (int i = 0; i < size; ++i)
+        assert(sv_value(s1, i) == (i % 350 == 0));
+    sv_destroy(s1);
+    sv_destroy(s50);
+    sv_destroy(sr);
+    sv_destroy(sv);
+
+    struct adaptive_vector a[4], res;
+    struct adaptive_vector* avs[4] = { &a[0], &a[1], &a[2], &a[3] };
+    assert(av_init(&a[0], dense) && a[0].repr == BV_DENSE);
+    assert(av_init(&a[1], mid) && a[1].repr == BV_DENSE);
+    assert(av_init(&a[2], few) && a[2].repr == BV_SPARSE);
+    assert(av_init(&a[3], rare) && a[3].repr == BV_SPARSE);
+
+    assert(av_multiple_and(&res, avs, 2) && res.repr == BV_DENSE);
+    for (int i = 0; i < size; ++i)
+        assert(bit(res.dense, i) == (i % 6 == 0));
+    av_destroy(&res);
+
+    assert(av_multiple_and(&res, avs, 3) && res.repr == BV_SPARSE);
+    assert(res.sparse->count == (size + 209) / 210);
+    for (int i = 0; i < size; ++i)
+        assert(sv_value(res.sparse, i) == (i % 210 == 0));
+    av_destroy(&res);
+
+    assert(av_multiple_and(&res, avs, 4) && res.repr == BV_SPARSE);
+    for (int i = 0; i < size; ++i)
+        assert(sv_value(res.sparse, i) == (i % 27300 == 0));
+    av_destroy(&res);
+
+    for (int i = 0; i < 4; ++i) av_destroy(&a[i]);
+}
+
+void
+stream_test()
+{
+    int size = 1 << 16;
+    struct bit_vector* bv1 = bv_create(size);
+    struct bit_vector* bv2 = bv_create(size);
+    struct bit_vector* ref = bv_create(size);
+    struct bit_vector* dst = bv_create(size);
+    assert(bv1 && bv2 && ref && dst);
+    for (int i = 0; i < size; ++i) {
+        bv_set(bv1, i, i % 3 == 0);
+        bv_set(bv2, i, i % 5 == 0);
+    }
+    struct bit_vector* bvs[2] = { bv1, bv2 };
+
+    // reference results through the cached path
+    bv_set_stream_threshold(SIZE_MAX);
+    bv_and_with_dst(ref, bv1, bv2);
+    bv_and_with_dst_stream(dst, bv1, bv2);
+    assert(memcmp(ref->arr, dst->arr, ref->allocated) == 0);
+    bv_xor_with_dst(ref, bv1, bv2);
+    bv_xor_with_dst_stream(dst, bv1, bv2);
+    assert(memcmp(ref->arr, dst->arr, ref->allocated) == 0);
+    bv_or_with_dst(ref, bv1, bv2);
+
+    // and through the automatic switch
+    bv_set_stream_threshold(256);
+    bv_or_with_dst(dst, bv1, bv2);
+    assert(memcmp(ref->arr, dst->arr, ref->allocated) == 0);
+    bv_multiple_and_256(dst, bvs, 2);
+    for (int i = 0; i < size; ++i)
+        assert(((dst->arr[i >> 3] >> (i & 7)) & 1) == (i % 15 == 0));
+    bv_set_stream_threshold(0);
+    assert(bv_stream_threshold() > 256);
+
+    bv_destroy(bv1);
+    bv_destroy(bv2);
+    bv_destroy(ref);
+    bv_destroy(dst);
+}
+
+void
+prefetch_test()
+{
+    int size = 1 << 16;
+    struct bit_vector* bvs[4];
+    struct bit_vector* dst = bv_create(size);
+    assert(dst);
+    for (int j = 0; j < 4; ++j) {
+        bvs[j] = bv_create(size);
+        assert(bvs[j]);
+        for (int i = 0; i < size; ++i)
+            bv_set(bvs[j], i, i % (j + 2) == 0);
+    }
+    bv_prefetch(bvs[0]);
+    bv_prefetch_range(bvs[1], 0, 1);
+    bv_prefetch_range(bvs[1], size - 100, 100);
+
+    static const elem_t dists[] = { 0, 64, 512, 4096, 1 << 20 };
+    for (int d = 0; d < 5; ++d) {
+        bv_set_prefetch_distance(dists[d]);
+        assert(bv_prefetch_distance() == dists[d]);
+        memset(dst->arr, 0xff, dst->allocated);
+        bv_multiple_and_256(dst, bvs, 4);
+        for (int i = 0; i < size; ++i)
+            assert(((dst->arr[i >> 3] >> (i & 7)) & 1) == (i % 60 == 0));
+    }
+
+    elem_t best = bv_calibrate_prefetch(size, 4);
+    assert(best == bv_prefetch_distance());
+    assert(best <= 4096);
+
+    for (int j = 0; j < 4; ++j) bv_destroy(bvs[j]);
+    bv_destroy(dst);
+}
+
+static int64_t
+naive_next(struct bit_vector* bv, elem_t from, bool val)
+{
+    for (elem_t i = from; i < bv->size; ++i)
+        if (bit(bv, i) == val) return i;
+    return -1;
+}
+
+void
+find_test()
+{
+    static const int sizes[] = { 1, 63, 64, 65, 511, 512, 513, 5000, 70000 };
+    for (int s = 0; s < 9; ++s) {
+        int size = sizes[s];
+        struct bit_vector* bv = bv_create(size);
+        assert(bv);
+        assert(bv_find_next(bv, 0) == -1 && bv_fls(bv) == -1);
+        assert(bv_ffz(bv) == 0);
+
+        // a few set bits far apart, so whole blocks are empty
+        for (int i = 7; i < size; i += 1237) bv_set(bv, i, true);
+        bv_set(bv, size - 1, true);
+        for (int from = 0; from < size; from += (size > 1000 ? 97 : 1))
+            assert(bv_find_next(bv, from) == naive_next(bv, from, true));
+        assert(bv_ffs(bv) == naive_next(bv, 0, true));
+        assert(bv_fls(bv) == size - 1);
+
+        // and the complement for the zero scans
+        for (int i = 0; i < size; ++i) bv_set(bv, i, !bit(bv, i));
+        for (int from = 0; from < size; from += (size > 1000 ? 97 : 1))
+            assert(bv_find_next_zero(bv, from) == naive_next(bv, from, false));
+        assert(bv_ffz(bv) == naive_next(bv, 0, false));
+        bv_set(bv, size - 1, false);
+        int64_t last = -1;
+        for (int i = 0; i < size; ++i)
+            if (bit(bv, i)) last = i;
+        assert(bv_fls(bv) == last);
+
+        for (int i = 0; i < size; ++i) bv_set(bv, i, true);
+        assert(bv_ffz(bv) == -1);
+        assert(bv_find_next_zero(bv, size / 2) == -1);
+        assert(bv_fls(bv) == size - 1);
+        bv_destroy(bv);
+    }
+}
+
+void
+topk_test()
+{
+    static const int sizes[] = { 100, 512, 5000, 100000 };
+    for (int s = 0; s < 4; ++s) {
+        int size = sizes[s];
+        struct bit_vector* bvs[3];
+        for (int j = 0; j < 3; ++j) {
+            bvs[j] = bv_create(size);
+            assert(bvs[j]);
+            for (int i = 0; i < size; ++i)
+                bv_set(bvs[j], i, i % (j + 2) == 0);
+        }
+        // matches are the multiples of 12
+        elem_t out[16];
+        int expect = min(16, (size + 11) / 12);
+        int n = bv_multiple_and_topk(bvs, 3, 16, out);
+        assert(n == expect);
+        for (int i = 0; i < n; ++i) assert(out[i] == (elem_t) i * 12);
+
+        n = bv_multiple_and_topk_reverse(bvs, 3, 16, out);
+        assert(n == expect);
+        elem_t last = (size - 1) / 12 * 12;
+        for (int i = 0; i < n; ++i) assert(out[i] == last - (elem_t) i * 12);
+
+        assert(bv_multiple_and_topk(bvs, 3, 0, out) == 0);
+        assert(bv_multiple_and_topk(bvs, 1, 1, out) == 1 && out[0] == 0);
+        for (int j = 0; j < 3; ++j) bv_destroy(bvs[j]);
+    }
+}
+
+static struct file_vector*
+temp_vector(char* path, elem_t size, struct bit_vector* init)
+{
+    strcpy(path, "/tmp/test_bitvector_XXXXXX");
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+    struct file_vector* fv = fv_create(path, size, 0);
+    assert(fv);
+    if (init) assert(fv_store(fv, init));
+    return fv;
+}
+
+void
+file_test()
+{
+    // spans three chunks, the last one partial
+    elem_t size = (FV_CHUNK_SIZE << 4) + 12345;
+    struct bit_vector* bv1 = bv_create(size);
+    struct bit_vector* bv2 = bv_create(size);
+    struct bit_vector* bv3 = bv_create(size);
+    assert(bv1 && bv2 && bv3);
+    for (elem_t i = 0; i < size; i += 3) bv_set(bv1, i, true);
+    for (elem_t i = 0; i < size; i += 5) bv_set(bv2, i, true);
+    for (elem_t i = 0; i < size; i += 7) bv_set(bv3, i, true);
+
+    char p1[32], p2[32], p3[32], pd[32];
+    struct file_vector* f1 = temp_vector(p1, size, bv1);
+    struct file_vector* f2 = temp_vector(p2, size, bv2);
+    struct file_vector* f3 = temp_vector(p3, size, bv3);
+    struct file_vector* dst = temp_vector(pd, size, NULL);
+
+    elem_t count;
+    assert(fv_popcount(f1, &count) && count == bv_popcount(bv1));
+
+    struct bit_vector* ref = bv_and(bv1, bv2);
+    assert(fv_and(dst, f1, f2));
+    struct bit_vector* res = fv_load(dst);
+    assert(res && memcmp(res->arr, ref->arr, ref->allocated) == 0);
+    bv_destroy(res);
+    bv_destroy(ref);
+
+    ref = bv_not(bv1);
+    assert(fv_not(dst, f1));
+    res = fv_load(dst);
+    assert(res && memcmp(res->arr, ref->arr, ref->allocated) == 0);
+    assert(fv_popcount(dst, &count) && count == size - bv_popcount(bv1));
+    bv_destroy(res);
+    bv_destroy(ref);
+
+    struct file_vector* fvs[3] = { f1, f2, f3 };
+    assert(fv_multiple_or(dst, fvs, 3));
+    res = fv_load(dst);
+    assert(res);
+    for (elem_t i = 0; i < size; i += 997)
+        assert(bit(res, i) == (i % 3 == 0 || i % 5 == 0 || i % 7 == 0));
+    bv_destroy(res);
+
+    // in place: ((dst & f3) ^ f3) | f2 == f2
+    struct file_vector* fvs2[2] = { dst, f3 };
+    assert(fv_multiple_and(dst, fvs2, 2));
+    assert(fv_xor(dst, dst, f3));
+    assert(fv_or(dst, dst, f2));
+    res = fv_load(dst);
+    assert(res);
+    for (elem_t i = 0; i < size; i += 997)
+        assert(bit(res, i) == (i % 5 == 0));
+    bv_destroy(res);
+
+    fv_close(dst);
+    dst = fv_open(pd, 0);
+    assert(dst && dst->size == size);
+
+    fv_close(f1);
+    fv_close(f2);
+    fv_close(f3);
+    fv_close(dst);
+    unlink(p1);
+    unlink(p2);
+    unlink(p3);
+    unlink(pd);
+    bv_destroy(bv1);
+    bv_destroy(bv2);
+    bv_destroy(bv3);
+}
+
+void
+similarity_test()
+{
+    int n = 37, size = 3000;
+    struct bit_vector* bvs[n];
+    for (int k = 0; k < n; ++k) {
+        bvs[k] = bv_create(size);
+        assert(bvs[k]);
+        for (int i = 0; i < size; ++i)
+            bv_set(bvs[k], i, (i * (k + 1)) % 7 < 3);
+    }
+    elem_t hamming[n * n];
+    double jaccard[n * n];
+    assert(bv_pairwise_distance(bvs, n, hamming, 3));
+    assert(bv_pairwise_jaccard(bvs, n, jaccard, 0));
+    for (int a = 0; a < n; ++a) {
+        for (int b = 0; b < n; ++b) {
+            elem_t diff = 0, inter = 0, uni = 0;
+            for (int i = 0; i < size; ++i) {
+                bool x = bit(bvs[a], i), y = bit(bvs[b], i);
+                diff += x != y;
+                inter += x && y;
+                uni += x || y;
+            }
+            assert(hamming[a * n + b] == diff);
+            assert(bv_hamming(bvs[a], bvs[b]) == diff);
+            double j = uni ? (double) inter / uni : 1.0;
+            assert(bv_jaccard(bvs[a], bvs[b]) == j);
+            assert(jaccard[a * n + b] == 1.0 - j ||
+                   (a == b && jaccard[a * n + b] == 0.0));
+        }
+    }
+
+    // differing sizes compare the common prefix
+    struct bit_vector* small = bv_create(100);
+    elem_t expect = 0;
+    for (int i = 0; i < 100; ++i) expect += bit(bvs[0], i);
+    assert(bv_hamming(small, bvs[0]) == expect);
+    bv_destroy(small);
+
+    // empty vectors are all at distance 0
+    struct bit_vector* empty[2] = { bv_create(0), bv_create(0) };
+    assert(empty[0] && empty[1]);
+    elem_t zeros[4] = {1, 1, 1, 1};
+    assert(bv_pairwise_distance(empty, 2, zeros, 0));
+    for (int k = 0; k < 4; ++k) assert(zeros[k] == 0);
+    double same[4];
+    assert(bv_pairwise_jaccard(empty, 2, same, 1));
+    for (int k = 0; k < 4; ++k) assert(same[k] == 0.0);
+    bv_destroy(empty[0]);
+    bv_destroy(empty[1]);
+    for (int k = 0; k < n; ++k) bv_destroy(bvs[k]);
+}
+
+void
+bloom_test()
+{
+    elem_t n = 20000;
+    double fpr = 0.01;
+    elem_t bits;
+    int k;
+    assert(bloom_size_for(n, fpr, &bits, &k));
+    assert(bloom_fpr(bits, k, n) <= fpr);
+    assert(bits % BLOOM_BLOCK_BITS == 0 && k >= 1 && k <= BLOOM_MAX_K);
+
+    struct bloom_filter* bf = bloom_create_for(n, fpr);
+    struct bloom_filter* bf2 = bloom_create(bits, k);
+    assert(bf && bf2);
+    uint64_t* keys = (uint64_t*) malloc(sizeof(uint64_t) * n * 6);
+    bool* out = (bool*) malloc(sizeof(bool) * n * 5);
+    assert(keys && out);
+    for (elem_t i = 0; i < n * 6; ++i) keys[i] = i * 0x9e3779b97f4a7c15ULL;
+
+    for (elem_t i = 0; i < n; ++i) bloom_insert(bf, keys[i]);
+    bloom_insert_batch(bf2, keys, n);
+    assert(memcmp(bf->bv->arr, bf2->bv->arr, bf->bv->allocated) == 0);
+
+    // no false negatives
+    assert(bloom_query_batch(bf, keys, n, out) == n);
+    for (elem_t i = 0; i < n; ++i) assert(bloom_query(bf, keys[i]));
+
+    // false positives close to the target
+    elem_t hits = bloom_query_batch(bf, keys + n, n * 5, out);
+    for (elem_t i = 0; i < n * 5; i += 101)
+        assert(out[i] == bloom_query(bf, keys[n + i]));
+    assert(hits < n * 5 * fpr * 2);
+
+    free(keys);
+    free(out);
+    bloom_destroy(bf);
+    bloom_destroy(bf2);
+}
+
+void
+lookup_service_test()
+{
+    int set_num = 16, size = 4096, n = 5000;
+    struct bit_vector* set[set_num];
+    for (int k = 0; k < set_num; ++k) {
+        set[k] = bv_create(size);
+        assert(set[k]);
+        for (int i = 0; i < size; ++i)
+            bv_set(set[k], i, i % (k + 2) == 0 || i == size - 1);
+    }
+    struct lookup_query* qs =
+        (struct lookup_query*) malloc(sizeof(*qs) * n);
+    int64_t* expect = (int64_t*) malloc(sizeof(int64_t) * n);
+    bool* seen = (bool*) calloc(n, sizeof(bool));
+    struct bit_vector* dst = bv_create(size);
+    assert(qs && expect && seen && dst);
+    for (int i = 0; i < n; ++i) {
+        qs[i].num = 1 + i % 4;
+        for (int j = 0; j < qs[i].num; ++j)
+            qs[i].ids[j] = (i * 7 + j * 3) % set_num;
+        qs[i].cookie = (void*) (intptr_t) i;
+        struct bit_vector* bvs[LS_MAX_OPERANDS];
+        for (int j = 0; j < qs[i].num; ++j) bvs[j] = set[qs[i].ids[j]];
+        bv_multiple_and_256(dst, bvs, qs[i].num);
+        expect[i] = bv_ffs(dst);
+    }
+
+    struct lookup_service* ls = ls_create(set, set_num, 3, NULL);
+    assert(ls);
+    int submitted = 0, received = 0;
+    struct lookup_result res[256];
+    while (received < n) {
+        if (submitted < n)
+            submitted += ls_submit(ls, qs + submitted,
+                                   min(n - submitted, 700));
+        int got = ls_poll(ls, res, 256);
+        for (int i = 0; i < got; ++i) {
+            int id = (int) (intptr_t) res[i].cookie;
+            assert(!seen[id]);
+            seen[id] = true;
+            assert(res[i].match == expect[id]);
+        }
+        received += got;
+        if (!got) sched_yield();
+    }
+    assert(ls_poll(ls, res, 256) == 0);
+    ls_destroy(ls);
+
+    bv_destroy(dst);
+    free(qs);
+    free(expect);
+    free(seen);
+    for (int k = 0; k < set_num; ++k) bv_destroy(set[k]);
+}
+
+void
+bank_test()
+{
+    int n = 6, size = 3000;
+    struct bit_vector* bvs[n];
+    for (int k = 0; k < n; ++k) {
+        bvs[k] = bv_create(size);
+        assert(bvs[k]);
+        for (int i = 0; i < size; ++i)
+            bv_set(bvs[k], i, i % (k + 2) == 0 || i > 2990);
+    }
+    struct vector_bank* vb = vb_from_bvs(bvs, n);
+    assert(vb && vb->num == n && vb->size == (elem_t) size);
+    for (int k = 0; k < n; ++k) {
+        struct bit_vector* bv = vb_to_bv(vb, k);
+        assert(bv);
+        assert(memcmp(bv->arr, bvs[k]->arr, bv->allocated) == 0);
+        for (int i = 0; i < size; i += 7)
+            assert(vb_value(vb, k, i) == bit(bvs[k], i));
+        bv_destroy(bv);
+    }
+
+    struct bit_vector* expect = bv_create(size);
+    struct bit_vector* dst = bv_create(size);
+    assert(expect && dst);
+    memset(dst->arr, 0xff, dst->allocated);
+    bv_multiple_and_256(expect, bvs, n);
+    vb_multiple_and(dst, vb, NULL, n);
+    assert(memcmp(dst->arr, expect->arr, dst->allocated) == 0);
+    assert(vb_multiple_and_ffs(vb, NULL, n) == bv_ffs(expect));
+
+    int ids[3] = {4, 1, 2};
+    struct bit_vector* sub[3] = {bvs[4], bvs[1], bvs[2]};
+    bv_multiple_and_256(expect, sub, 3);
+    vb_multiple_and(dst, vb, ids, 3);
+    assert(memcmp(dst->arr, expect->arr, dst->allocated) == 0);
+    assert(vb_multiple_and_ffs(vb, ids, 3) == 0);
+
+    // lcm(2..7) = 420 is the next common bit, then nothing
+    vb_set(vb, 0, 0, false);
+    assert(vb_multiple_and_ffs(vb, NULL, n) == 420);
+    for (int i = 0; i < size; ++i)
+        if (i % 420 == 0 || i > 2990) vb_set(vb, 3, i, false);
+    assert(vb_multiple_and_ffs(vb, NULL, n) == -1);
+    assert(vb_load(vb, 3, dst));
+    assert(bv_popcount(dst) == bv_popcount(bvs[3]) - 8 - 9);
+
+    struct bit_vector* other = bv_create(size + 1);
+    assert(other);
+    assert(!vb_store(vb, 0, other));
+    bvs[0]->size++;
+    assert(vb_from_bvs(bvs, n) == NULL);
+    bvs[0]->size--;
+
+    bv_destroy(other);
+    bv_destroy(expect);
+    bv_destroy(dst);
+    vb_destroy(vb);
+    for (int k = 0; k < n; ++k) bv_destroy(bvs[k]);
+}
+
+void
+bitmap_index_test()
+{
+    elem_t rows = 2000;
+    uint32_t column[rows];
+    struct bit_vector* dst = bv_create(rows);
+    assert(dst);
+    // every [lo, hi) of every encoding for a few small domains
+    for (uint32_t card = 1; card <= 9; ++card) {
+        for (elem_t r = 0; r < rows; ++r)
+            column[r] = (r * 7919) % card;
+        for (int enc = BI_EQUALITY; enc <= BI_BITSLICED; ++enc) {
+            struct bitmap_index* bi = bi_build(column, rows, enc);
+            assert(bi && bi->card == card);
+            for (uint64_t lo = 0; lo <= card + 1; ++lo) {
+                for (uint64_t hi = 0; hi <= card + 1; ++hi) {
+                    memset(dst->arr, 0xff, dst->allocated);
+                    bi_range(bi, lo, hi, dst);
+                    for (elem_t r = 0; r < rows; ++r)
+                        assert(bit(dst, r) == (column[r] >= lo && column[r] < hi));
+                    for (elem_t r = rows; r < dst->allocated << 3; ++r)
+                        assert(!bit(dst, r));
+                }
+            }
+            bi_destroy(bi);
+        }
+    }
+
+    // wide values only fit bit-sliced
+    for (elem_t r = 0; r < rows; ++r)
+        column[r] = (uint32_t) (r * 2654435761U);
+    assert(bi_build(column, rows, BI_RANGE) == NULL);
+    struct bitmap_index* bi = bi_build(column, rows, BI_BITSLICED);
+    assert(bi && bi->num == 32);
+    uint64_t bounds[][2] = {
+        {0, 1ULL << 32}, {1000, 1 << 30}, {3000000000U, 3000000001U},
+        {column[17], column[17] + 1ULL}, {5, 5},
+    };
+    for (int q = 0; q < 5; ++q) {
+        bi_range(bi, bounds[q][0], bounds[q][1], dst);
+        for (elem_t r = 0; r < rows; ++r)
+            assert(bit(dst, r) ==
+                   (column[r] >= bounds[q][0] && column[r] < bounds[q][1]));
+    }
+    bi_equal(bi, column[17], dst);
+    assert(bit(dst, 17));
+    bi_destroy(bi);
+    bv_destroy(dst);
+}
+
+void
+view_test()
+{
+    elem_t size = 5000;
+    struct bit_vector* a = bv_create(size);
+    struct bit_vector* b = bv_create(size);
+    struct bit_vector* dst = bv_create(size);
+    assert(a && b && dst);
+    uint32_t x = 2463534242U;
+    for (elem_t i = 0; i < size; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        bv_set(a, i, x & 1);
+        bv_set(b, i, (x & 6) != 0);
+    }
+    // ends at the vector's last bit, so shifted loads meet the allocation
+    elem_t from[] = {0, 1, 7, 8, 9, 63, 64, 250, 1000, 4000, 4999, 5000};
+    elem_t len[] = {0, 1, 63, 64, 65, 255, 256, 257, 700, 2000, 3990};
+    for (int f = 0; f < 12; ++f) {
+        for (int l = 0; l < 12; ++l) {
+            elem_t n = l < 11 ? len[l] : size - from[f];
+            if (from[f] + n > size) continue;
+            struct bit_view va = vw_of(a, from[f], n);
+            struct bit_view vb = vw_of(b, size - n, n);
+            elem_t count = 0;
+            for (elem_t i = 0; i < n; ++i) {
+                assert(vw_value(va, i) == bit(a, from[f] + i));
+                count += bit(a, from[f] + i);
+            }
+            assert(vw_popcount(va) == count);
+
+            int64_t expect = -1;
+            for (elem_t i = 0; i < n; ++i) {
+                if (bit(a, from[f] + i)) {
+                    if (expect < 0) expect = i;
+                    if (i > 300) {
+                        assert(vw_find_next(va, 301) == (int64_t) i);
+                        break;
+                    }
+                }
+            }
+            assert(vw_ffs(va) == expect);
+
+            for (int op = 0; op < 5; ++op) {
+                memset(dst->arr, 0xff, dst->allocated);
+                switch (op) {
+                case 0: vw_copy(dst, va); break;
+                case 1: vw_not(dst, va); break;
+                case 2: vw_and(dst, va, vb); break;
+                case 3: vw_or(dst, va, vb); break;
+                default: vw_xor(dst, va, vb); break;
+                }
+                for (elem_t i = 0; i < n; ++i) {
+                    bool p = bit(a, from[f] + i), q = bit(b, size - n + i);
+                    bool r = op == 0 ? p : op == 1 ? !p : op == 2 ? p && q
+                           : op == 3 ? p || q : p != q;
+                    assert(bit(dst, i) == r);
+                }
+                for (elem_t i = n; i < dst->allocated << 3; ++i)
+                    assert(!bit(dst, i));
+            }
+        }
+    }
+
+    // sub views compose, multi-AND over three offsets
+    struct bit_view sub = vw_sub(vw_of(a, 3, 4000), 10, 3000);
+    assert(sub.offset == 5 && sub.arr == a->arr + 1);
+    struct bit_view vs[3] = { vw_of(a, 13, 2000), vw_of(b, 0, 2000),
+                              vw_of(a, 2990, 2000) };
+    vw_multiple_and(dst, vs, 3);
+    for (elem_t i = 0; i < 2000; ++i) {
+        assert(bit(dst, i) ==
+               (bit(a, 13 + i) && bit(b, i) && bit(a, 2990 + i)));
+    }
+    elem_t iterated = 0;
+    for (int64_t i = vw_ffs(sub); i >= 0; i = vw_find_next(sub, i + 1)) {
+        assert(bit(a, 13 + i));
+        iterated++;
+    }
+    assert(iterated == vw_popcount(sub));
+
+    // a byte-aligned view reads no further than its own last byte
+    uint8_t* raw = (uint8_t*) malloc(32);
+    assert(raw);
+    memset(raw, 0x0f, 32);
+    struct bit_view whole = {raw, 0, 256};
+    assert(vw_popcount(whole) == 128 && vw_find_next(whole, 5) == 8);
+    free(raw);
+
+    // operands of different lengths, the result stops at the shorter one
+    memset(a->arr, 0xff, ROUNDUP8(size) >> 3);
+    elem_t lens[][2] = {{10, 100}, {100, 10}, {70, 300}, {300, 1000}};
+    for (int l = 0; l < 4; ++l) {
+        elem_t n = min(lens[l][0], lens[l][1]);
+        for (int op = 0; op < 2; ++op) {
+            struct bit_view va = vw_of(a, 0, lens[l][0]);
+            struct bit_view vb = vw_of(b, 3, lens[l][1]);
+            memset(dst->arr, 0xff, dst->allocated);
+            if (op) vw_xor(dst, va, vb);
+            else vw_or(dst, va, vb);
+            elem_t expect = 0;
+            for (elem_t i = 0; i < n; ++i) expect += op ? !bit(b, 3 + i) : 1;
+            assert(bv_popcount(dst) == expect);
+        }
+    }
+
+    bv_destroy(a);
+    bv_destroy(b);
+    bv_destroy(dst);
+}
+
+void
+threshold_test()
+{
+    int max_n = 13, size = 1500;
+    struct bit_vector* bvs[max_n];
+    struct bit_vector* slices[BV_MAX_COUNT_SLICES];
+    struct bit_vector* dst = bv_create(size);
+    assert(dst);
+    uint32_t x = 88172645U;
+    for (int k = 0; k < max_n; ++k) {
+        bvs[k] = bv_create(size);
+        assert(bvs[k]);
+        for (int i = 0; i < size; ++i) {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            bv_set(bvs[k], i, x % 3 != 0);
+        }
+    }
+    for (int j = 0; j < BV_MAX_COUNT_SLICES; ++j) {
+        slices[j] = bv_create(size);
+        assert(slices[j]);
+    }
+    assert(bv_count_slices(1) == 1 && bv_count_slices(3) == 2 &&
+           bv_count_slices(4) == 3 && bv_count_slices(255) == 8);
+
+    for (int n = 1; n <= max_n; ++n) {
+        int levels = bv_count_slices(n);
+        bv_count_per_position(slices, bvs, n);
+        for (int i = 0; i < size; ++i) {
+            int c = 0, got = 0;
+            for (int k = 0; k < n; ++k) c += bit(bvs[k], i);
+            for (int j = 0; j < levels; ++j) got |= bit(slices[j], i) << j;
+            assert(got == c);
+        }
+        for (int k = -1; k <= n + 1; ++k) {
+            bv_threshold(dst, bvs, n, k);
+            for (int i = 0; i < size; ++i) {
+                int c = 0;
+                for (int j = 0; j < n; ++j) c += bit(bvs[j], i);
+                assert(bit(dst, i) == (c >= k));
+            }
+            for (elem_t i = size; i < dst->allocated << 3; ++i)
+                assert(!bit(dst, i));
+        }
+        bv_majority(dst, bvs, n);
+        for (int i = 0; i < size; ++i) {
+            int c = 0;
+            for (int j = 0; j < n; ++j) c += bit(bvs[j], i);
+            assert(bit(dst, i) == (2 * c > n));
+        }
+    }
+
+    bv_destroy(dst);
+    for (int k = 0; k < max_n; ++k) bv_destroy(bvs[k]);
+    for (int j = 0; j < BV_MAX_COUNT_SLICES; ++j) bv_destroy(slices[j]);
+}
+
+static struct bit_matrix*
+random_matrix(elem_t rows, elem_t cols, uint32_t* x)
+{
+    struct bit_matrix* m = bm_create(rows, cols);
+    assert(m);
+    for (elem_t i = 0; i < rows; ++i) {
+        for (elem_t j = 0; j < cols; ++j) {
+            *x ^= *x << 13; *x ^= *x >> 17; *x ^= *x << 5;
+            bm_set(m, i, j, *x & 1);
+        }
+    }
+    return m;
+}
+
+void
+matrix_test()
+{
+    uint32_t x = 1234567U;
+    // odd shapes, the last ones span several tiles, row blocks and tables
+    elem_t shapes[][3] = {
+        {1, 1, 1}, {5, 9, 3}, {37, 70, 131}, {64, 512, 64},
+        {2100, 20, 5000}, {300, 520, 1100},
+    };
+    for (int s = 0; s < 6; ++s) {
+        elem_t m = shapes[s][0], k = shapes[s][1], n = shapes[s][2];
+        struct bit_matrix* a = random_matrix(m, k, &x);
+        struct bit_matrix* b = random_matrix(k, n, &x);
+        struct bit_matrix* c = bm_create(m, n);
+        assert(c);
+        memset(c->arr, 0xff, m * c->stride);
+        assert(bm_mul(c, a, b, s % 3));
+        for (elem_t i = 0; i < m; i += 7) {
+            for (elem_t j = 0; j < n; ++j) {
+                bool v = false;
+                for (elem_t l = 0; l < k; ++l)
+                    v ^= bm_get(a, i, l) && bm_get(b, l, j);
+                assert(bm_get(c, i, j) == v);
+            }
+            for (elem_t j = n; j < c->stride << 3; ++j)
+                assert(!((bm_row(c, i)[j >> 3] >> (j & 7)) & 1));
+        }
+
+        // A x against row i of C for x = column j of B
+        struct bit_vector* col = bv_create(k);
+        struct bit_vector* y = bv_create(m);
+        struct bit_vector* row = bv_create(n);
+        struct bit_vector* sel = bv_create(m);
+        assert(col && y && row && sel);
+        elem_t j = n / 2;
+        for (elem_t l = 0; l < k; ++l) bv_set(col, l, bm_get(b, l, j));
+        bm_mul_vec(y, a, col);
+        for (elem_t i = 0; i < m; ++i)
+            assert(bit(y, i) == bm_get(c, i, j));
+        // e_i^T C is row i of C
+        bv_set(sel, m - 1, true);
+        bm_vec_mul(row, sel, c);
+        struct bit_vector* expect = bv_create(n);
+        assert(expect && bm_load_row(c, m - 1, expect));
+        assert(memcmp(row->arr, expect->arr, row->allocated) == 0);
+
+        bv_destroy(col);
+        bv_destroy(y);
+        bv_destroy(row);
+        bv_destroy(sel);
+        bv_destroy(expect);
+        bm_destroy(a);
+        bm_destroy(b);
+        bm_destroy(c);
+    }
+}
+
+static void*
+stats_thread(void* arg)
+{
+    return (void*) bv_popcount((struct bit_vector*) arg);
+}
+
+void
+stats_test()
+{
+    struct bv_stats before, after;
+    struct bit_vector* a = bv_create(4096);
+    struct bit_vector* b = bv_create(4096);
+    assert(a && b);
+    bv_set(a, 100, true);
+    bv_stats_snapshot(&before);
+    bv_and_with_dst(b, a, a);
+    assert(bv_ffs(b) == 100);
+    // counts of exited threads are kept
+    pthread_t tid;
+    void* ret;
+    assert(pthread_create(&tid, NULL, stats_thread, a) == 0);
+    pthread_join(tid, &ret);
+    assert((elem_t) ret == 1);
+    bv_stats_snapshot(&after);
+
+#ifdef BV_STATS
+    assert(after.ops[BV_OP_AND].count == before.ops[BV_OP_AND].count + 1);
+    assert(after.ops[BV_OP_AND].bytes ==
+           before.ops[BV_OP_AND].bytes + 2 * b->allocated);
+    assert(after.ops[BV_OP_SCAN].count == before.ops[BV_OP_SCAN].count + 1);
+    assert(after.ops[BV_OP_POPCOUNT].count ==
+           before.ops[BV_OP_POPCOUNT].count + 1);
+    for (int op = 0; op < BV_OP_NUM; ++op) {
+        uint64_t sum = 0;
+        for (int k = 0; k < BV_STATS_BUCKETS; ++k)
+            sum += after.ops[op].hist[k];
+        assert(sum == after.ops[op].samples);
+        assert(sum <= after.ops[op].count);
+    }
+#else
+    for (int op = 0; op < BV_OP_NUM; ++op)
+        assert(after.ops[op].count == 0 && before.ops[op].count == 0);
+#endif
+    FILE* fp = fopen("/dev/null", "w");
+    assert(fp);
+    bv_stats_dump(fp);
+    fclose(fp);
+    assert(strcmp(bv_stats_op_name(BV_OP_MULTIPLE_AND), "multiple_and") == 0);
+
+    bv_destroy(a);
+    bv_destroy(b);
+}
+
+void
+segmented_test()
+{
+    // 2048-bit segments, so that 5000 bits span three with a partial tail
+    const elem_t size = 5000;
+    uint32_t x = 7654321U;
+    struct seg_vector* svs[3];
+    bool ref[3][5000];
+    for (int v = 0; v < 3; ++v) {
+        svs[v] = sg_create(size, SG_MIN_SHIFT);
+        assert(svs[v] && svs[v]->num == 3);
+        for (elem_t i = 0; i < size; ++i) {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            ref[v][i] = (x & 3) != 0;
+            sg_set(svs[v], i, ref[v][i]);
+        }
+    }
+    assert(sg_create(size, SG_MIN_SHIFT - 1) == NULL);
+
+    struct seg_vector* dst = sg_create(size, SG_MIN_SHIFT);
+    assert(dst);
+    sg_and(dst, svs[0], svs[1]);
+    for (elem_t i = 0; i < size; ++i)
+        assert(sg_value(dst, i) == (ref[0][i] && ref[1][i]));
+    sg_or(dst, svs[0], svs[1]);
+    for (elem_t i = 0; i < size; ++i)
+        assert(sg_value(dst, i) == (ref[0][i] || ref[1][i]));
+    sg_xor(dst, svs[0], svs[1]);
+    for (elem_t i = 0; i < size; ++i)
+        assert(sg_value(dst, i) == (ref[0][i] != ref[1][i]));
+    sg_multiple_and(dst, svs, 3);
+    elem_t expect = 0;
+    for (elem_t i = 0; i < size; ++i) {
+        bool b = ref[0][i] && ref[1][i] && ref[2][i];
+        assert(sg_value(dst, i) == b);
+        expect += b;
+    }
+    assert(sg_popcount(dst) == expect);
+    int64_t pos = -1;
+    for (elem_t i = 0; i < size; ++i) {
+        if (!sg_value(dst, i)) continue;
+        assert(sg_find_next(dst, pos + 1) == (int64_t) i);
+        pos = i;
+    }
+    assert(sg_find_next(dst, pos + 1) == -1);
+
+    // not keeps the tail of the last segment clear
+    sg_not(dst, svs[0]);
+    expect = 0;
+    for (elem_t i = 0; i < size; ++i) expect += !ref[0][i];
+    assert(sg_popcount(dst) == expect);
+
+    // a single bit in the last segment
+    sg_and(dst, dst, svs[0]);
+    assert(sg_ffs(dst) == -1);
+    sg_set(dst, 4999, true);
+    assert(sg_ffs(dst) == 4999 && sg_find_next(dst, 2048) == 4999);
+
+    // growth appends segments and never moves the existing ones
+    struct seg_vector* sv = sg_create(0, SG_MIN_SHIFT);
+    assert(sv && sv->num == 0 && sg_ffs(sv) == -1);
+    for (elem_t i = 0; i < 7000; ++i) {
+        assert(sg_push(sv, i % 7 == 0));
+        if (i == 0) assert(sv->num == 1);
+    }
+    struct bit_vector* first = sg_segment(sv, 0);
+    assert(sv->size == 7000 && sv->num == 4);
+    assert(sg_popcount(sv) == 1000);
+    // shrinking clears what falls off, growing again brings back zeros
+    assert(sg_resize(sv, 2100) && sv->num == 2);
+    assert(sg_resize(sv, 7000) && sv->num == 4);
+    assert(sg_segment(sv, 0) == first);
+    assert(sg_popcount(sv) == 300);
+    assert(sg_find_next(sv, 2100) == -1);
+    sg_destroy(sv);
+
+    // pushing only exposes a power-of-two prefix of the last segment
+    sv = sg_create(0, 16);
+    for (elem_t i = 0; i < 3000; ++i)
+        assert(sg_push(sv, i == 2999));
+    assert(sg_segment(sv, 0)->allocated == 512);
+    assert(sg_segment(sv, 0)->size == 3000);
+    assert(sg_popcount(sv) == 1 && sg_ffs(sv) == 2999);
+    assert(sg_resize(sv, 100) && sg_segment(sv, 0)->allocated == 256);
+    assert(sg_resize(sv, 70000) && sv->num == 2 && sg_popcount(sv) == 0);
+    assert(sg_segment(sv, 0)->allocated == 8192);
+
+    sg_destroy(sv);
+    sg_destroy(dst);
+    for (int v = 0; v < 3; ++v) sg_destroy(svs[v]);
+
+    // bv_value reads one bit, not the rest of the byte above it
+    struct bit_vector* bv = bv_create(16);
+    bv_set(bv, 3, true);
+    bv_set(bv, 1, true);
+    assert(bv_value(bv, 1) && !bv_value(bv, 2) && bv_value(bv, 3));
+    bv_destroy(bv);
+}
+
+void
+packed_test()
+{
+    // three whole blocks and a partial one
+    const elem_t n = 1000;
+    uint32_t x = 2463534242U;
+    uint32_t vals[1000], out[1000];
+    struct bit_vector* res = bv_create(n + 5);
+    assert(res);
+    assert(pa_create(n, 0) == NULL && pa_create(n, 33) == NULL);
+
+    for (int k = 1; k <= 32; ++k) {
+        uint32_t mask = KBITS_MASK_32(k);
+        struct packed_array* pa = pa_create(n, k);
+        assert(pa);
+        for (elem_t i = 0; i < n; ++i) {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            vals[i] = x;
+        }
+        // bits above k are dropped
+        pa_pack(pa, 0, vals, n);
+        for (elem_t i = 0; i < n; ++i) {
+            vals[i] &= mask;
+            assert(pa_get(pa, i) == vals[i]);
+        }
+        memset(out, 0, sizeof(out));
+        pa_unpack(pa, 0, n, out);
+        assert(memcmp(out, vals, sizeof(out)) == 0);
+        pa_unpack(pa, 37, 900, out);
+        assert(memcmp(out, vals + 37, 900 * sizeof(uint32_t)) == 0);
+
+        // unaligned bulk and single stores leave their neighbours alone
+        for (elem_t i = 100; i < 700; ++i) out[i - 100] = ~vals[i] & mask;
+        pa_pack(pa, 100, out, 600);
+        for (elem_t i = 0; i < n; i += 3) {
+            vals[i] = (vals[i] * 2654435761U) & mask;
+            pa_set(pa, i, vals[i]);
+        }
+        for (elem_t i = 0; i < n; ++i) {
+            uint32_t v = (i >= 100 && i < 700 && i % 3) ? ~vals[i] & mask
+                                                        : vals[i];
+            assert(pa_get(pa, i) == v);
+            vals[i] = v;
+        }
+
+        uint32_t consts[] = {0, mask >> 1, mask, mask + 1};
+        for (int c = 0; c < 4; ++c) {
+            uint32_t cv = consts[c];
+            for (int op = PA_EQ; op <= PA_GE; ++op) {
+                pa_compare(res, pa, (enum pa_cmp) op, cv);
+                for (elem_t i = 0; i < n; ++i) {
+                    uint32_t v = vals[i];
+                    bool e = op == PA_EQ ? v == cv : op == PA_NE ? v != cv :
+                             op == PA_LT ? v < cv : op == PA_LE ? v <= cv :
+                             op == PA_GT ? v > cv : v >= cv;
+                    assert(bit(res, i) == e);
+                }
+                for (elem_t i = n; i < res->size; ++i) assert(!bit(res, i));
+            }
+        }
+        pa_destroy(pa);
+    }
+    bv_destroy(res);
+}
+
+void
+ring_test()
+{
+    // last[i]: rotation id was last inserted in, -1 if never
+    const elem_t size = 3000;
+    const int num = 4;
+    int last[3000];
+    for (elem_t i = 0; i < size; ++i) last[i] = -1;
+    struct ring_bitmap* rb = rb_create(size, num);
+    assert(rb);
+    struct bit_vector* uni = bv_create(size);
+    assert(uni);
+    elem_t ids[64];
+    bool out[64];
+    uint32_t x = 88172645U;
+
+    for (int r = 0; r < 20; ++r) {
+        // a cluster of ids in the low blocks, keeping some blocks stale
+        int n = r % 5 == 4 ? 0 : 64;
+        for (int j = 0; j < n; ++j) {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+            ids[j] = (r & 1) ? x % size : x % 700;
+            last[ids[j]] = r;
+        }
+        if (r & 2) {
+            rb_insert_batch(rb, ids, n);
+        } else {
+            for (int j = 0; j < n; ++j) rb_insert(rb, ids[j]);
+        }
+
+        // query some before and some after the union is rebuilt
+        elem_t hits = rb_query_batch(rb, ids, n, out);
+        assert(hits == (elem_t) n);
+        for (int j = 0; j < n; ++j) assert(out[j]);
+        elem_t expect = 0;
+        for (elem_t i = 0; i < size; ++i) {
+            bool live = last[i] >= 0 && last[i] > r - num;
+            assert(rb_query(rb, i) == live);
+            expect += live;
+        }
+        rb_union(rb, uni);
+        assert(bv_popcount(uni) == expect);
+        rb_rotate(rb);
+    }
+    // the whole window expires
+    for (int r = 0; r < num; ++r) rb_rotate(rb);
+    rb_union(rb, uni);
+    assert(bv_popcount(uni) == 0);
+    rb_insert(rb, 2999);
+    assert(rb_query(rb, 2999) && !rb_query(rb, 2998));
+
+    bv_destroy(uni);
+    rb_destroy(rb);
+}
+
+static int
+match_cmp(const void* a, const void* b)
+{
+    const struct ba_match* x = (const struct ba_match*) a;
+    const struct ba_match* y = (const struct ba_match*) b;
+    if (x->end != y->end) return x->end < y->end ? -1 : 1;
+    return x->pattern - y->pattern;
+}
+
+void
+bitap_test()
+{
+    // a two-letter text, so that long patterns taken from it recur
+    enum { LEN = 6000, NUM = 9, MAX = 20000 };
+    static uint8_t text[LEN];
+    static struct ba_match got[MAX], expect[MAX];
+    uint32_t x = 1597334677U;
+    for (int i = 0; i < LEN; ++i) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        text[i] = (x % 7) ? 'a' : 'b';
+    }
+    // lengths around the 64-bit word and SIMD register boundaries
+    elem_t lens[NUM] = {1, 3, 63, 64, 65, 255, 257, 513, 9};
+    const uint8_t* pats[NUM];
+    for (int p = 0; p < NUM; ++p)
+        pats[p] = text + (p * 611) % (LEN - 600);
+    pats[8] = (const uint8_t*) "zzzzzzzzz";
+    assert(ba_create(pats, lens, 0) == NULL);
+
+    elem_t n = 0;
+    for (int e = 0; e < LEN; ++e) {
+        for (int p = 0; p < NUM; ++p) {
+            if ((elem_t) e + 1 < lens[p]) continue;
+            if (memcmp(text + e + 1 - lens[p], pats[p], lens[p])) continue;
+            assert(n < MAX);
+            expect[n].pattern = p;
+            expect[n].end = e;
+            n++;
+        }
+    }
+    assert(n > (elem_t) LEN);
+
+    struct bitap* ba = ba_create(pats, lens, NUM);
+    assert(ba);
+    // fed in uneven pieces, matches span the cuts
+    for (int round = 0; round < 2; ++round) {
+        elem_t found = 0;
+        for (elem_t t = 0; t < LEN; ) {
+            elem_t piece = min((elem_t) (round ? 1 + t % 97 : LEN), LEN - t);
+            found += ba_scan(ba, text + t, piece, got + found, MAX - found);
+            t += piece;
+        }
+        assert(found == n);
+        qsort(got, found, sizeof(got[0]), match_cmp);
+        for (elem_t i = 0; i < n; ++i)
+            assert(got[i].pattern == expect[i].pattern &&
+                   got[i].end == expect[i].end);
+        ba_reset(ba);
+    }
+
+    // output is capped, the count is not
+    assert(ba_scan(ba, text, LEN, got, 10) == n);
+    ba_reset(ba);
+    assert(ba_scan(ba, (const uint8_t*) "xyzzzzzzzzzz", 12, got, 10) == 2);
+    assert(got[0].pattern == 8 && got[0].end == 10);
+    assert(got[1].pattern == 8 && got[1].end == 11);
+    ba_destroy(ba);
+}
+
 int
 main()
 {
     macro_test();
+    sparse_test();
+    stream_test();
+    prefetch_test();
+    find_test();
+    topk_test();
+    file_test();
+    similarity_test();
+    bloom_test();
+    lookup_service_test();
+    bank_test();
+    bitmap_index_test();
+    view_test();
+    threshold_test();
+    matrix_test();
+    stats_test();
+    segmented_test();
+    packed_test();
+    ring_test();
+    bitap_test();
 
     //for (int i = 0; i <= 1024 * 32; i++) {
     for (int i = 0; i <= 1024; i++) {
@@ -0,0 +1,69 @@
+/**
+ * Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+
+#include "bitvector.hpp"
+
+template <std::size_t N>
+void
+template_test()
+{
+    bv::bitvector<N> a, b;
+    assert(a.ffs() == -1);
+    assert(a.popcount() == 0);
+    for (std::size_t i = 0; i < N; i += 3) a.set(i);
+    for (std::size_t i = 0; i < N; i += 5) b.set(i);
+
+    bv::bitvector<N> c = a & b;
+    bv::bitvector<N> d = a | b;
+    bv::bitvector<N> e = a ^ b;
+    bv::bitvector<N> f = ~a;
+    for (std::size_t i = 0; i < N; ++i) {
+        assert(c.test(i) == (i % 15 == 0));
+        assert(d.test(i) == (i % 3 == 0 || i % 5 == 0));
+        assert(e.test(i) == ((i % 3 == 0) != (i % 5 == 0)));
+        assert(f.test(i) == (i % 3 != 0));
+    }
+    assert(a.popcount() + f.popcount() == N);
+    assert(f.ffs() == (N > 1 ? 1 : -1));
+
+    c.clear();
+    c.set(N - 1);
+    assert(c.ffs() == (int64_t) (N - 1));
+
+    // round trip through the C API
+    struct bit_vector* cbv = a.to_c();
+    assert(cbv != NULL);
+    for (std::size_t i = 0; i < N; ++i)
+        assert(((cbv->arr[i >> 3] >> (i & 7)) & 1) == a.test(i));
+    bv::bitvector<N> g(cbv);
+    assert(g == a);
+    bv_destroy(cbv);
+
+    const bv::bitvector<N>* ops[] = { &a, &b, &d };
+    bv::bitvector<N> h;
+    bv::multiple_and(h, ops, 3);
+    assert(h == (a & b));
+}
+
+int
+main()
+{
+    template_test<1>();
+    template_test<63>();
+    template_test<64>();
+    template_test<100>();
+    template_test<256>();
+    template_test<300>();
+    template_test<512>();
+    template_test<4096>();
+    template_test<10000>();
+    static_assert(sizeof(bv::bitvector<256>) == 32, "256 bits fit in a ymm");
+    static_assert(sizeof(bv::bitvector<512>) == 64, "512 bits fit in a zmm");
+    printf("test_bitvector_hpp: OK\n");
+    return 0;
+}
@@ -0,0 +1,144 @@
+/**
+ *  threshold.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "prefetch.h"
+#include "threshold.h"
+
+/**
+ * Vertical counter for 256 positions.  c[j] is bit j of the count;
+ * pend[j] holds one not yet added input of weight 2^j, so that every
+ * addition is a full adder (carry-save) c[j] + pend[j] + v and only the
+ * carry moves up a level.
+ */
+struct csa_counter {
+    __m256i c[BV_MAX_COUNT_SLICES + 1];
+    __m256i pend[BV_MAX_COUNT_SLICES + 1];
+    bool has[BV_MAX_COUNT_SLICES + 1];
+};
+
+static inline void
+csa_init(struct csa_counter* cnt, int levels)
+{
+    for (int j = 0; j <= levels; ++j) {
+        cnt->c[j] = _mm256_setzero_si256();
+        cnt->has[j] = false;
+    }
+}
+
+static inline void
+csa_add(struct csa_counter* cnt, int level, __m256i v)
+{
+    while (cnt->has[level]) {
+        cnt->has[level] = false;
+        __m256i a = cnt->c[level], b = cnt->pend[level];
+        __m256i u = _mm256_xor_si256(a, b);
+        cnt->c[level] = _mm256_xor_si256(u, v);
+        v = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, v));
+        level++;
+    }
+    cnt->pend[level] = v;
+    cnt->has[level] = true;
+}
+
+// folds the pending inputs in with half adders
+static inline void
+csa_flush(struct csa_counter* cnt, int levels)
+{
+    for (int j = 0; j < levels; ++j) {
+        if (!cnt->has[j]) continue;
+        cnt->has[j] = false;
+        __m256i a = cnt->c[j], b = cnt->pend[j];
+        cnt->c[j] = _mm256_xor_si256(a, b);
+        __m256i carry = _mm256_and_si256(a, b);
+        if (!_mm256_testz_si256(carry, carry)) csa_add(cnt, j + 1, carry);
+    }
+}
+
+// counts the bvs at byte offset i into cnt->c[0..levels)
+static inline void
+count_block(struct csa_counter* cnt, int levels,
+            struct bit_vector** bvs, int bv_num, elem_t i)
+{
+    csa_init(cnt, levels);
+    for (int j = 0; j < bv_num; ++j)
+        csa_add(cnt, 0, _mm256_load_si256((__m256i*) (bvs[j]->arr+i)));
+    csa_flush(cnt, levels);
+}
+
+int
+bv_count_slices(int bv_num)
+{
+    assert(bv_num >= 0 && bv_num < (1 << BV_MAX_COUNT_SLICES));
+    return bv_num ? 32 - __builtin_clz(bv_num) : 1;
+}
+
+void
+bv_count_per_position(struct bit_vector** slices,
+                      struct bit_vector** bvs, int bv_num)
+{
+    int levels = bv_count_slices(bv_num);
+    elem_t count = slices[0]->allocated;
+    struct csa_counter cnt;
+    for (elem_t i = 0; i < count; i += 32) {
+        count_block(&cnt, levels, bvs, bv_num, i);
+        for (int j = 0; j < levels; ++j)
+            _mm256_store_si256((__m256i*) (slices[j]->arr+i), cnt.c[j]);
+    }
+}
+
+void
+bv_threshold(struct bit_vector* dst,
+             struct bit_vector** bvs, int bv_num, int k)
+{
+    elem_t count = dst->allocated;
+    if (k <= 0) {
+        // every position qualifies, keep the padding clear
+        memset(dst->arr, 0xff, count);
+        if (dst->size & 7) dst->arr[dst->size >> 3] = (1 << (dst->size & 7)) - 1;
+        memset(dst->arr + ROUNDUP8(dst->size) / 8, 0,
+               count - ROUNDUP8(dst->size) / 8);
+        return;
+    }
+    if (k > bv_num) {
+        memset(dst->arr, 0, count);
+        return;
+    }
+
+    int levels = bv_count_slices(bv_num);
+    struct csa_counter cnt;
+    for (elem_t i = 0; i < count; i += 32) {
+        count_block(&cnt, levels, bvs, bv_num, i);
+        // count >= k, compared slice by slice from the top
+        __m256i gt = _mm256_setzero_si256();
+        __m256i eq = _mm256_set1_epi8(-1);
+        for (int j = levels - 1; j >= 0; --j) {
+            if ((k >> j) & 1) {
+                eq = _mm256_and_si256(eq, cnt.c[j]);
+            } else {
+                gt = _mm256_or_si256(gt, _mm256_and_si256(eq, cnt.c[j]));
+                eq = _mm256_andnot_si256(cnt.c[j], eq);
+            }
+        }
+        _mm256_store_si256((__m256i*) (dst->arr+i), _mm256_or_si256(gt, eq));
+    }
+}
+
+void
+bv_majority(struct bit_vector* dst, struct bit_vector** bvs, int bv_num)
+{
+    bv_threshold(dst, bvs, bv_num, bv_num / 2 + 1);
+}
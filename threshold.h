@@ -0,0 +1,51 @@
+/**
+ *  threshold.h
+ *
+ *  Per-position counts over N vectors and "at least k of N" selection.
+ *  The counts are kept bit-sliced (slice j holds bit j of every
+ *  position's count) and built with SIMD carry-save adders, 256
+ *  positions at a time, so the cost is O(N x length / 256) vector ops.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef THRESHOLD_H
+#define THRESHOLD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bv_num is limited to 2^BV_MAX_COUNT_SLICES - 1
+#define BV_MAX_COUNT_SLICES 20
+
+// slices needed to count up to bv_num, ceil(log2(bv_num + 1))
+int
+bv_count_slices(int bv_num);
+
+/**
+ * slices[j] = bit j of the number of vectors set at every position, for
+ * j < bv_count_slices(bv_num).  All vectors must have the same size as
+ * the slices.
+ */
+void
+bv_count_per_position(struct bit_vector** slices,
+                      struct bit_vector** bvs, int bv_num);
+
+// dst = positions set in at least k of the bv_num vectors
+void
+bv_threshold(struct bit_vector* dst,
+             struct bit_vector** bvs, int bv_num, int k);
+
+// positions set in more than half of the vectors
+void
+bv_majority(struct bit_vector* dst, struct bit_vector** bvs, int bv_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ *  vector_bank.c
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <immintrin.h>
+
+#include "common.h"
+#include "bit_utils.h"
+#include "bitvector.h"
+#include "prefetch.h"
+#include "vector_bank.h"
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+static inline uint8_t*
+block_ptr(struct vector_bank* vb, int idx, elem_t block)
+{
+    return vb->arr + (block * vb->num + idx) * VB_BLOCK_SIZE;
+}
+
+// byte offset of every operand inside one interleaved block group
+static inline void
+operand_offsets(struct vector_bank* vb, const int* ids, int id_num,
+                elem_t* off)
+{
+    for (int j = 0; j < id_num; ++j) {
+        int idx = ids ? ids[j] : j;
+        assert(idx >= 0 && idx < vb->num);
+        off[j] = (elem_t) idx * VB_BLOCK_SIZE;
+    }
+}
+
+struct vector_bank*
+vb_create(elem_t bit_size, int num)
+{
+    assert(num > 0);
+    elem_t blocks = ROUNDUP512(bit_size) >> 9;
+    size_t msize = sizeof(struct vector_bank) + blocks * num * VB_BLOCK_SIZE;
+
+    // large banks go on huge pages: one TLB entry covers 2 MiB of stream
+    void* p;
+    size_t align = msize >= HUGE_PAGE_SIZE ? HUGE_PAGE_SIZE : 64;
+    if (posix_memalign(&p, align, msize)) return NULL;
+#ifdef MADV_HUGEPAGE
+    if (align == HUGE_PAGE_SIZE) madvise(p, ROUNDUP4K(msize), MADV_HUGEPAGE);
+#endif
+
+    struct vector_bank* vb = (struct vector_bank*) p;
+    vb->size = bit_size;
+    vb->blocks = blocks;
+    vb->num = num;
+    memset(vb->arr, 0, blocks * num * VB_BLOCK_SIZE);
+    return vb;
+}
+
+void
+vb_destroy(struct vector_bank* vb)
+{
+    free(vb);
+}
+
+struct vector_bank*
+vb_from_bvs(struct bit_vector** bvs, int bv_num)
+{
+    for (int i = 1; i < bv_num; ++i) {
+        if (bvs[i]->size != bvs[0]->size) return NULL;
+    }
+    struct vector_bank* vb = vb_create(bvs[0]->size, bv_num);
+    if (vb == NULL) return NULL;
+    for (int i = 0; i < bv_num; ++i)
+        vb_store(vb, i, bvs[i]);
+    return vb;
+}
+
+bool
+vb_store(struct vector_bank* vb, int idx, struct bit_vector* bv)
+{
+    if (idx < 0 || idx >= vb->num || bv->size != vb->size) return false;
+    for (elem_t b = 0; b < vb->blocks; ++b)
+        memcpy(block_ptr(vb, idx, b), bv->arr + b * VB_BLOCK_SIZE,
+               VB_BLOCK_SIZE);
+    return true;
+}
+
+bool
+vb_load(struct vector_bank* vb, int idx, struct bit_vector* bv)
+{
+    if (idx < 0 || idx >= vb->num || bv->size != vb->size) return false;
+    for (elem_t b = 0; b < vb->blocks; ++b)
+        memcpy(bv->arr + b * VB_BLOCK_SIZE, block_ptr(vb, idx, b),
+               VB_BLOCK_SIZE);
+    return true;
+}
+
+struct bit_vector*
+vb_to_bv(struct vector_bank* vb, int idx)
+{
+    struct bit_vector* bv = bv_create(vb->size);
+    if (bv == NULL) return NULL;
+    if (!vb_load(vb, idx, bv)) {
+        bv_destroy(bv);
+        return NULL;
+    }
+    return bv;
+}
+
+void
+vb_set(struct vector_bank* vb, int idx, elem_t bit, bool flag)
+{
+    assert(idx >= 0 && idx < vb->num && bit < vb->size);
+    uint8_t* p = block_ptr(vb, idx, bit >> 9) + ((bit & 511) >> 3);
+    *p = (*p & ~(1 << (bit & 7))) | (flag << (bit & 7));
+}
+
+bool
+vb_value(struct vector_bank* vb, int idx, elem_t bit)
+{
+    assert(idx >= 0 && idx < vb->num && bit < vb->size);
+    uint8_t* p = block_ptr(vb, idx, bit >> 9) + ((bit & 511) >> 3);
+    return (*p >> (bit & 7)) & 1;
+}
+
+void
+vb_multiple_and(struct bit_vector* dst, struct vector_bank* vb,
+                const int* ids, int id_num)
+{
+    assert(id_num > 0 && dst->size >= vb->size);
+    elem_t off[id_num];
+    operand_offsets(vb, ids, id_num, off);
+
+    // same number of blocks ahead as the per-vector kernels
+    elem_t stride = (elem_t) vb->num * VB_BLOCK_SIZE;
+    elem_t ahead = bv_prefetch_distance() / VB_BLOCK_SIZE * stride;
+    elem_t total = vb->blocks * stride;
+    elem_t pf_end = (ahead && ahead < total) ? total - ahead : 0;
+
+    uint8_t* arr = dst->arr;
+    for (elem_t pos = 0; pos < total; pos += stride, arr += VB_BLOCK_SIZE) {
+        const uint8_t* grp = vb->arr + pos;
+        if (pos < pf_end) {
+            for (int j = 0; j < id_num; ++j)
+                rte_prefetch0((uint8_t*) grp+ahead+off[j]);
+        }
+        __m256i res0 = _mm256_load_si256((__m256i*) (grp+off[0]));
+        __m256i res1 = _mm256_load_si256((__m256i*) (grp+off[0]+32));
+        for (int j = 1; j < id_num; ++j) {
+            res0 = _mm256_and_si256(res0, _mm256_load_si256((__m256i*) (grp+off[j])));
+            res1 = _mm256_and_si256(res1, _mm256_load_si256((__m256i*) (grp+off[j]+32)));
+        }
+        _mm256_store_si256((__m256i*) arr, res0);
+        _mm256_store_si256((__m256i*) (arr+32), res1);
+    }
+    memset(arr, 0, dst->allocated - vb->blocks * VB_BLOCK_SIZE);
+}
+
+int64_t
+vb_multiple_and_ffs(struct vector_bank* vb, const int* ids, int id_num)
+{
+    assert(id_num > 0);
+    elem_t off[id_num];
+    operand_offsets(vb, ids, id_num, off);
+
+    elem_t stride = (elem_t) vb->num * VB_BLOCK_SIZE;
+    const uint8_t* grp = vb->arr;
+    for (elem_t b = 0; b < vb->blocks; ++b, grp += stride) {
+        __m256i r0 = _mm256_load_si256((__m256i*) (grp+off[0]));
+        __m256i r1 = _mm256_load_si256((__m256i*) (grp+off[0]+32));
+        for (int j = 1; j < id_num; ++j) {
+            __m256i o = _mm256_or_si256(r0, r1);
+            if (_mm256_testz_si256(o, o)) break;
+            r0 = _mm256_and_si256(r0, _mm256_load_si256((__m256i*) (grp+off[j])));
+            r1 = _mm256_and_si256(r1, _mm256_load_si256((__m256i*) (grp+off[j]+32)));
+        }
+        __m256i o = _mm256_or_si256(r0, r1);
+        if (likely(_mm256_testz_si256(o, o))) continue;
+
+        uint64_t res[8];
+        _mm256_storeu_si256((__m256i*) res, r0);
+        _mm256_storeu_si256((__m256i*) (res+4), r1);
+        for (int w = 0; w < 8; ++w) {
+            if (res[w])
+                return (int64_t) ((b << 9) + (w << 6) + __builtin_ctzll(res[w]));
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,81 @@
+/**
+ *  vector_bank.h
+ *
+ *  A bank of equal-length bit vectors stored interleaved block by block:
+ *  block 0 of vector 0, block 0 of vector 1, ..., block 1 of vector 0 ...
+ *  Vectors that are always ANDed together (one per field of a rule set)
+ *  then sit side by side, so a multi-AND over the bank reads one
+ *  contiguous stream instead of one stream per operand.
+ *
+ *  Hiroshi Tokaku <tkk@hongo.wide.ad.jp>
+ **/
+#ifndef VECTOR_BANK_H
+#define VECTOR_BANK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "bitvector.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// bytes of one vector stored contiguously, one cache line
+#define VB_BLOCK_SIZE 64
+
+struct vector_bank {
+    // bit length of every vector
+    elem_t size;
+    // VB_BLOCK_SIZE blocks per vector
+    elem_t blocks;
+    int num;
+    uint8_t arr[0] __attribute__((aligned(64)));
+};
+
+// num clear vectors of bit_size bits
+struct vector_bank*
+vb_create(elem_t bit_size, int num);
+
+void
+vb_destroy(struct vector_bank* vb);
+
+// interleaves copies of bvs, which must all have the same size
+struct vector_bank*
+vb_from_bvs(struct bit_vector** bvs, int bv_num);
+
+// copies bv (of the bank's size) into vector idx
+bool
+vb_store(struct vector_bank* vb, int idx, struct bit_vector* bv);
+
+// copies vector idx out to bv (of the bank's size)
+bool
+vb_load(struct vector_bank* vb, int idx, struct bit_vector* bv);
+
+// vector idx as a new independent vector
+struct bit_vector*
+vb_to_bv(struct vector_bank* vb, int idx);
+
+void
+vb_set(struct vector_bank* vb, int idx, elem_t bit, bool flag);
+
+bool
+vb_value(struct vector_bank* vb, int idx, elem_t bit);
+
+/**
+ * dst = AND of the vectors ids[0..id_num), or of the first id_num
+ * vectors if ids is NULL.  dst must be at least the bank's size; its bits
+ * past that are cleared.
+ */
+void
+vb_multiple_and(struct bit_vector* dst, struct vector_bank* vb,
+                const int* ids, int id_num);
+
+// lowest set bit of the same AND without materializing it, -1 if none
+int64_t
+vb_multiple_and_ffs(struct vector_bank* vb, const int* ids, int id_num);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif